@@ -0,0 +1,222 @@
+// com_ptr.h - COM reference ownership shared by the C++ tools (platform-neutral, std only)
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+
+#if defined(_WIN32) && defined(TAB_MERGER_COM_ACCOUNTING)
+#include <unknwn.h>
+#endif
+
+// --- COM reference ownership ---
+// ComPtr owns one reference to a COM interface and releases it when it goes out of scope, so
+// early returns cannot leak. Built with -DTAB_MERGER_COM_ACCOUNTING, every reference taken through
+// a ComPtr is counted per interface and call site, and the peak number of live references and of
+// live objects, and any reference still outstanding at exit, are reported on stderr. Objects are
+// told apart by their IUnknown pointer, so two interfaces of one tab count as one object. Each tool
+// names the interfaces it uses with TAB_MERGER_COM_INTERFACE.
+#ifdef TAB_MERGER_COM_ACCOUNTING
+template <typename T> const char* ComInterfaceName();
+#define TAB_MERGER_COM_INTERFACE(T) template <> inline const char* ComInterfaceName<T>() { return #T; }
+
+// COM guarantees that QueryInterface for IUnknown returns the same pointer for every interface of
+// an object, unlike the interface pointers themselves. Off Windows (in the tests) fake objects
+// specialize this instead.
+template <typename T> const void* ComObjectIdentity(T* p);
+#ifdef _WIN32
+template <typename T> const void* ComObjectIdentity(T* p) {
+    IUnknown* unknown = nullptr;
+    if (FAILED(p->QueryInterface(IID_IUnknown, reinterpret_cast<void**>(&unknown))) || !unknown) {
+        return p;
+    }
+    unknown->Release();
+    return unknown;
+}
+#endif
+
+class ComAccounting {
+public:
+    static ComAccounting& Get() {
+        static ComAccounting instance;
+        return instance;
+    }
+
+    void Acquired(const std::string& site, const void* object) {
+        Counts& c = sites_[site];
+        ++c.total;
+        c.peak = std::max(c.peak, ++c.live);
+        peak_ = std::max(peak_, ++live_);
+        if (++objects_[object] == 1) {
+            peakObjects_ = std::max(peakObjects_, (long)objects_.size());
+        }
+    }
+
+    void Released(const std::string& site, const void* object) {
+        --sites_[site].live;
+        --live_;
+        auto it = objects_.find(object);
+        if (it != objects_.end() && --it->second == 0) {
+            objects_.erase(it);
+        }
+    }
+
+    long LiveReferences() const { return live_; }
+    long PeakReferences() const { return peak_; }
+    long LiveObjects() const { return (long)objects_.size(); }
+    long PeakObjects() const { return peakObjects_; }
+    long Outstanding(const std::string& site) const {
+        auto it = sites_.find(site);
+        return it == sites_.end() ? 0 : it->second.live;
+    }
+
+    void Report(std::ostream& out) const {
+        out << "[com] Peak live references: " << peak_ << ", peak live objects: " << peakObjects_
+            << ", outstanding at exit: " << live_ << " reference(s) to " << objects_.size() << " object(s)\n";
+        for (const auto& entry : sites_) {
+            const Counts& c = entry.second;
+            out << "[com] " << (c.live ? "LEAK " : "") << entry.first << ": taken " << c.total
+                << ", peak " << c.peak << ", outstanding " << c.live << "\n";
+        }
+    }
+
+    ~ComAccounting() { Report(std::cerr); }
+
+private:
+    struct Counts {
+        long live = 0;
+        long total = 0;
+        long peak = 0;
+    };
+    std::map<std::string, Counts> sites_;
+    std::map<const void*, long> objects_;
+    long live_ = 0;
+    long peak_ = 0;
+    long peakObjects_ = 0;
+};
+#endif
+
+template <typename T>
+class ComPtr {
+public:
+    // Returned by Put(): converts to the out-parameter a COM call fills in, and records the
+    // reference once that call has returned (at the end of the full expression).
+    class OutParam {
+    public:
+        OutParam(ComPtr& owner) : owner_(owner) {}
+        ~OutParam() { owner_.Track(); }
+        operator T**() { return &owner_.p_; }
+        operator void**() { return reinterpret_cast<void**>(&owner_.p_); }
+
+    private:
+        ComPtr& owner_;
+    };
+
+    ComPtr() = default;
+    ComPtr(const ComPtr&) = delete;
+    ComPtr& operator=(const ComPtr&) = delete;
+    ComPtr(ComPtr&& other) noexcept { MoveFrom(other); }
+    ComPtr& operator=(ComPtr&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+    ~ComPtr() { Reset(); }
+
+    T* Get() const { return p_; }
+    T* operator->() const { return p_; }
+    explicit operator bool() const { return p_ != nullptr; }
+
+    // Releases the current reference and receives a new one from a COM out-parameter.
+    OutParam Put(const char* file = __builtin_FILE(), int line = __builtin_LINE()) {
+        Reset();
+        SetSite(file, line);
+        return OutParam(*this);
+    }
+
+    // Takes an additional reference to a pointer owned by someone else (e.g. a VARIANT).
+    void Assign(T* p, const char* file = __builtin_FILE(), int line = __builtin_LINE()) {
+        Reset();
+        if (p) {
+            p->AddRef();
+            p_ = p;
+            SetSite(file, line);
+            Track();
+        }
+    }
+
+    // Takes ownership of a reference the caller already holds (e.g. an object it just created).
+    void Attach(T* p, const char* file = __builtin_FILE(), int line = __builtin_LINE()) {
+        Reset();
+        if (p) {
+            p_ = p;
+            SetSite(file, line);
+            Track();
+        }
+    }
+
+    // Builds the accounting site name a reference taken at file:line is reported under.
+    static std::string SiteName(const char* file, int line) {
+        std::string name = file;
+        size_t slash = name.find_last_of("/\\");
+#ifdef TAB_MERGER_COM_ACCOUNTING
+        std::string type = ComInterfaceName<T>();
+#else
+        std::string type = "?";
+#endif
+        return type + " @ " + name.substr(slash == std::string::npos ? 0 : slash + 1) + ":" + std::to_string(line);
+    }
+
+    void Reset() {
+        if (p_) {
+#ifdef TAB_MERGER_COM_ACCOUNTING
+            if (tracked_) ComAccounting::Get().Released(site_, object_);
+            tracked_ = false;
+#endif
+            p_->Release();
+            p_ = nullptr;
+        }
+    }
+
+private:
+    void SetSite(const char* file, int line) {
+#ifdef TAB_MERGER_COM_ACCOUNTING
+        site_ = SiteName(file, line);
+#else
+        (void)file;
+        (void)line;
+#endif
+    }
+
+    void Track() {
+#ifdef TAB_MERGER_COM_ACCOUNTING
+        if (p_ && !tracked_) {
+            object_ = ComObjectIdentity(p_);
+            ComAccounting::Get().Acquired(site_, object_);
+            tracked_ = true;
+        }
+#endif
+    }
+
+    void MoveFrom(ComPtr& other) {
+        p_ = other.p_;
+        other.p_ = nullptr;
+#ifdef TAB_MERGER_COM_ACCOUNTING
+        site_ = std::move(other.site_);
+        object_ = other.object_;
+        tracked_ = other.tracked_;
+        other.tracked_ = false;
+#endif
+    }
+
+    T* p_ = nullptr;
+#ifdef TAB_MERGER_COM_ACCOUNTING
+    std::string site_;
+    const void* object_ = nullptr;
+    bool tracked_ = false;
+#endif
+};
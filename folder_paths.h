@@ -0,0 +1,191 @@
+// folder_paths.h - Canonicalize and check requested folders before any UI work (platform-neutral)
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// --- Path classification ---
+// A requested folder is made absolute and lexically normalized, then checked for existence and
+// type, so a mistyped path or an offline share is rejected before a new tab is created for it.
+// Shell namespace locations (shell:Downloads, ::{CLSID}) are passed through unchecked.
+enum class PathStatus { Ok, Empty, NotFound, NotDirectory, Unreachable, TimedOut };
+
+struct ResolvedPath {
+    std::string path;
+    PathStatus status;
+    int error; // from the file system (0 when there is none)
+};
+
+// Command line paths are in the ANSI code page on Windows.
+#ifdef _WIN32
+inline std::filesystem::path NativeFolderPath(const std::string& path) {
+    int length = MultiByteToWideChar(CP_ACP, 0, path.data(), (int)path.size(), nullptr, 0);
+    std::wstring wide(length, L'\0');
+    if (length > 0) MultiByteToWideChar(CP_ACP, 0, path.data(), (int)path.size(), &wide[0], length);
+    return std::filesystem::path(wide);
+}
+
+inline std::string NarrowFolderPath(const std::filesystem::path& path) {
+    const std::wstring& wide = path.native();
+    int length = WideCharToMultiByte(CP_ACP, 0, wide.data(), (int)wide.size(), nullptr, 0, nullptr, nullptr);
+    std::string narrow(length, '\0');
+    if (length > 0) WideCharToMultiByte(CP_ACP, 0, wide.data(), (int)wide.size(), &narrow[0], length, nullptr, nullptr);
+    return narrow;
+}
+#else
+inline std::filesystem::path NativeFolderPath(const std::string& path) { return std::filesystem::path(path); }
+inline std::string NarrowFolderPath(const std::filesystem::path& path) { return path.string(); }
+#endif
+
+inline bool IsShellNamespacePath(const std::string& path) {
+    return path.rfind("shell:", 0) == 0 || path.rfind("::", 0) == 0;
+}
+
+// The absolute, normalized form of a path; the input itself if it cannot be made absolute.
+inline std::string CanonicalFolderPath(const std::string& input) {
+    std::error_code ec;
+    std::filesystem::path absolute = std::filesystem::absolute(NativeFolderPath(input), ec);
+    return ec ? input : NarrowFolderPath(absolute.lexically_normal());
+}
+
+inline ResolvedPath ResolveFolderPath(const std::string& input) {
+    if (input.empty()) {
+        return { input, PathStatus::Empty, 0 };
+    }
+    if (IsShellNamespacePath(input)) {
+        return { input, PathStatus::Ok, 0 };
+    }
+
+    std::string path = CanonicalFolderPath(input);
+    std::error_code ec;
+    std::filesystem::file_status status = std::filesystem::status(NativeFolderPath(path), ec);
+    if (status.type() == std::filesystem::file_type::not_found) {
+        return { path, PathStatus::NotFound, ec.value() };
+    }
+    if (ec) {
+        return { path, PathStatus::Unreachable, ec.value() };
+    }
+    if (status.type() != std::filesystem::file_type::directory) {
+        return { path, PathStatus::NotDirectory, 0 };
+    }
+    return { path, PathStatus::Ok, 0 };
+}
+
+// --- Parallel resolution with per-path deadlines ---
+// All requested paths are probed in parallel on worker threads the caller provides (a private
+// Windows thread pool in open_folder_tab). Each path gets its own deadline, timeout after its probe
+// started, so a fast path queued behind a slow share is not charged for the share's wait; a path
+// still queued timeout after the batch started is given up without being probed. Probes that miss
+// their deadline finish on their own after Resolve has returned. Repeated inputs are probed once.
+class FolderPathResolver {
+public:
+    using Probe = std::function<ResolvedPath(const std::string&)>;
+    // Queues a task on a worker thread; false when it could not be queued (it then runs inline).
+    using Submit = std::function<bool(std::function<void()>)>;
+
+    FolderPathResolver(Submit submit, std::chrono::milliseconds timeout, Probe probe = ResolveFolderPath)
+        : submit_(std::move(submit)), timeout_(timeout), probe_(std::move(probe)) {}
+
+    std::vector<ResolvedPath> Resolve(const std::vector<std::string>& inputs) {
+        auto batch = std::make_shared<Batch>();
+        std::map<std::string, size_t> cache;
+        for (const auto& input : inputs) {
+            if (cache.emplace(input, batch->entries.size()).second) {
+                batch->entries.push_back({ input, ProbeState::Queued, {}, { input, PathStatus::TimedOut, 0 } });
+            }
+        }
+
+        Clock::time_point queueDeadline = Clock::now() + timeout_;
+        for (size_t i = 0; i < batch->entries.size(); ++i) {
+            Probe probe = probe_;
+            if (!submit_([batch, i, probe] { RunProbe(*batch, i, probe); })) {
+                RunProbe(*batch, i, probe_);
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(batch->lock);
+        for (;;) {
+            Clock::time_point now = Clock::now();
+            Clock::time_point next = Clock::time_point::max();
+            for (auto& entry : batch->entries) {
+                if (entry.state == ProbeState::Done || entry.state == ProbeState::GivenUp) continue;
+                Clock::time_point deadline = entry.state == ProbeState::Running ? entry.startedAt + timeout_ : queueDeadline;
+                if (now >= deadline) {
+                    entry.state = ProbeState::GivenUp;
+                } else {
+                    next = std::min(next, deadline);
+                }
+            }
+            if (next == Clock::time_point::max()) break;
+            batch->changed.wait_until(lock, next);
+        }
+
+        std::vector<ResolvedPath> resolved;
+        resolved.reserve(inputs.size());
+        for (const auto& input : inputs) {
+            const Entry& entry = batch->entries[cache[input]];
+            resolved.push_back(entry.state == ProbeState::Done
+                                   ? entry.result
+                                   : ResolvedPath{ input, PathStatus::TimedOut, (int)std::errc::timed_out });
+        }
+        return resolved;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    enum class ProbeState { Queued, Running, Done, GivenUp };
+
+    struct Entry {
+        std::string input;
+        ProbeState state;
+        Clock::time_point startedAt;
+        ResolvedPath result;
+    };
+
+    // Shared between Resolve and the workers, so late probes can still finish after it returned.
+    struct Batch {
+        std::mutex lock;
+        std::condition_variable changed;
+        std::vector<Entry> entries;
+    };
+
+    static void RunProbe(Batch& batch, size_t index, const Probe& probe) {
+        std::string input;
+        {
+            std::lock_guard<std::mutex> lock(batch.lock);
+            Entry& entry = batch.entries[index];
+            if (entry.state != ProbeState::Queued) return; // given up while queued
+            entry.state = ProbeState::Running;
+            entry.startedAt = Clock::now();
+            input = entry.input;
+        }
+        ResolvedPath result = probe(input);
+        {
+            std::lock_guard<std::mutex> lock(batch.lock);
+            Entry& entry = batch.entries[index];
+            if (entry.state == ProbeState::Running) {
+                entry.result = result;
+                entry.state = ProbeState::Done;
+            }
+        }
+        batch.changed.notify_all();
+    }
+
+    Submit submit_;
+    std::chrono::milliseconds timeout_;
+    Probe probe_;
+};
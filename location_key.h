@@ -0,0 +1,49 @@
+// location_key.h - Canonical form of Explorer locations shared by the C++ tools (Windows)
+#pragma once
+
+#include <windows.h>
+#include <shlwapi.h>
+
+#include <algorithm>
+#include <string>
+
+// --- Location keys ---
+// Locations are compared by a canonical key (local path for file: URLs, lower case, backslashes,
+// no trailing separator), so the same folder matches however it was typed or navigated to. Both
+// tools use these keys: open_folder_tab to find a tab already showing a folder, merge_tabs to
+// confirm that a new tab reached its location.
+inline std::string LowerAnsi(std::string s) {
+    if (!s.empty()) {
+        CharLowerBuffA(&s[0], (DWORD)s.size());
+    }
+    return s;
+}
+
+inline std::string LocationKeyFromPath(const std::string& path) {
+    if (path.rfind("::", 0) == 0) {
+        return LowerAnsi("shell:" + path);
+    }
+    if (path.rfind("shell:", 0) == 0) {
+        return LowerAnsi(path);
+    }
+
+    std::string key = LowerAnsi(path);
+    std::replace(key.begin(), key.end(), '/', '\\');
+    while (key.size() > 3 && key.back() == '\\') {
+        key.pop_back();
+    }
+    return key;
+}
+
+inline std::string LocationKeyFromUrl(const std::string& url) {
+    if (url.rfind("file:", 0) == 0) {
+        // The decoded path is never longer than the URL it came from.
+        std::string path(url.size() + 1, '\0');
+        DWORD len = (DWORD)path.size();
+        if (SUCCEEDED(PathCreateFromUrlA(url.c_str(), &path[0], &len, 0))) {
+            path.resize(len);
+            return LocationKeyFromPath(path);
+        }
+    }
+    return LocationKeyFromPath(url);
+}
@@ -0,0 +1,170 @@
+// merge_journal.h - Append-only progress journal of merge_tabs (platform-neutral, std only)
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// --- Merge journal ---
+// The merge plan and the progress of every step are appended to a small per-session journal and
+// flushed after each record. If a merge is interrupted (killed, timed out, hung window), the next
+// run reads the journal and skips donor tabs that were already moved, so partly drained donor
+// windows are not duplicated into the first window. The journal is removed when a merge finishes.
+//
+// Every run appends its own segment, starting with a plan record; indices are local to a segment.
+// Tabs moved by any segment for the same first window count as moved, so a resumed run does not
+// have to copy the earlier progress and a crash right after it starts loses nothing. A record only
+// counts once its terminating newline was written: a record torn by the interruption is ignored
+// when loading and cut off before the next run appends.
+//
+// Journal format (tab separated, one record per line):
+//   plan <firstWindow>
+//   url <index> <donor HWND> <url>
+//   created <index>
+//   navigated <index>
+//   closed <donor HWND>
+struct JournalItem {
+    std::string url;
+    uintptr_t donor;
+};
+
+class MergeJournal {
+public:
+    // Returns the donor tabs that interrupted merges into firstWindow had already moved.
+    static std::vector<JournalItem> LoadMoved(const std::string& path, uintptr_t firstWindow) {
+        std::vector<JournalItem> moved;
+        std::ifstream in(path);
+        if (!in) {
+            return moved;
+        }
+
+        Segment segment;
+        std::string line;
+        // getline sets eof only when the last line has no newline, i.e. was torn.
+        while (std::getline(in, line) && !in.eof()) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+
+            std::vector<std::string> fields;
+            std::istringstream ls(line);
+            std::string field;
+            while (std::getline(ls, field, '\t')) {
+                fields.push_back(field);
+            }
+            if (fields.size() < 2) continue;
+
+            uint64_t value = 0;
+            if (!ParseNumber(fields[1], value)) continue;
+
+            if (fields[0] == "plan" && fields.size() == 2) {
+                segment.CollectMoved(moved);
+                segment = Segment();
+                segment.samePlan = (uintptr_t)value == firstWindow;
+            } else if (fields[0] == "url" && fields.size() == 4) {
+                uint64_t donor = 0;
+                if (!ParseNumber(fields[2], donor)) continue;
+                segment.Grow((size_t)value);
+                segment.planned[(size_t)value] = { fields[3], (uintptr_t)donor };
+                segment.hasUrl[(size_t)value] = true;
+            } else if (fields[0] == "navigated" && fields.size() == 2) {
+                segment.Grow((size_t)value);
+                segment.navigated[(size_t)value] = true;
+            }
+        }
+        segment.CollectMoved(moved);
+        return moved;
+    }
+
+    bool Open(const std::string& path, uintptr_t firstWindow) {
+        path_ = path;
+        TrimTornRecord(path);
+        out_.open(path, std::ios::out | std::ios::app);
+        if (!out_) {
+            std::cerr << "[warn] Could not write merge journal: " << path << "\n";
+            return false;
+        }
+        out_ << "plan\t" << firstWindow << std::endl;
+        return true;
+    }
+
+    void Planned(size_t index, const JournalItem& item) {
+        Write("url\t" + std::to_string(index) + "\t" + std::to_string(item.donor) + "\t" + item.url);
+    }
+    void Created(size_t index) { Write("created\t" + std::to_string(index)); }
+    void Navigated(size_t index) { Write("navigated\t" + std::to_string(index)); }
+    void Closed(uintptr_t donor) { Write("closed\t" + std::to_string(donor)); }
+
+    void Finish() {
+        if (out_.is_open()) {
+            out_.close();
+            std::remove(path_.c_str());
+        }
+    }
+
+private:
+    struct Segment {
+        bool samePlan = false;
+        std::vector<JournalItem> planned;
+        std::vector<bool> hasUrl;
+        std::vector<bool> navigated;
+
+        void Grow(size_t index) {
+            if (index >= planned.size()) {
+                planned.resize(index + 1);
+                hasUrl.resize(index + 1, false);
+                navigated.resize(index + 1, false);
+            }
+        }
+
+        void CollectMoved(std::vector<JournalItem>& moved) const {
+            if (!samePlan) return;
+            for (size_t i = 0; i < planned.size(); ++i) {
+                if (hasUrl[i] && navigated[i]) moved.push_back(planned[i]);
+            }
+        }
+    };
+
+    // Accepts only a complete decimal number, so "12abc" is not read as 12.
+    static bool ParseNumber(const std::string& text, uint64_t& value) {
+        if (text.empty() || !std::all_of(text.begin(), text.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+            return false;
+        }
+        try {
+            value = std::stoull(text);
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+    // Cuts a record without its newline off the end of the journal, so appending to it cannot turn
+    // the torn record into a complete one.
+    static void TrimTornRecord(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return;
+        std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        in.close();
+
+        size_t complete = content.find_last_of('\n');
+        complete = complete == std::string::npos ? 0 : complete + 1;
+        if (complete < content.size()) {
+            std::error_code ec;
+            std::filesystem::resize_file(path, complete, ec);
+        }
+    }
+
+    void Write(const std::string& record) {
+        if (out_.is_open()) {
+            out_ << record << std::endl;
+        }
+    }
+
+    std::string path_;
+    std::ofstream out_;
+};
@@ -0,0 +1,241 @@
+// merge_scheduler.h - Session and host-wide merge slot protocol of merge_tabs (platform-neutral, std only)
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// --- Merge slots ---
+// Each session runs at most one merge at a time (a second request waits for it, since the running
+// merge already picks up every window), and the whole host shares a fixed number of merge slots so
+// explorer.exe and the CPU are not flooded. Background (automatic) merges may only use part of the
+// slots, which keeps slots free for interactive requests.
+//
+// Every slot is a mutex of its own and a merge waits for any one of them. A mutex whose holder dies
+// is handed to the next waiter as abandoned, which still counts as acquired, so a crashed or killed
+// merge never takes a slot with it (a counting semaphore would lose it for good).
+//
+// The session lock is taken first: a merge queued behind another merge of its session holds no
+// host slot while it waits. A background merge then takes a background slot before a global slot,
+// so at most the background share of the global slots is ever held or waited for by background
+// merges.
+static const size_t kMaxMergeSlots = 64; // MAXIMUM_WAIT_OBJECTS: one wait covers every slot
+
+struct MergeSlotCounts {
+    size_t slots;
+    size_t backgroundSlots;
+};
+
+inline MergeSlotCounts HostSlotCounts(unsigned processors) {
+    size_t slots = std::min(kMaxMergeSlots, std::max<size_t>(2, processors / 2));
+    return { slots, std::max<size_t>(1, slots / 2) };
+}
+
+enum class SlotWait { Acquired, Abandoned, TimedOut, Unavailable };
+
+// The named objects of the protocol: merge_tabs implements them with named mutexes, the tests with
+// in-process ones. Unavailable means the objects could not be opened; the merge then runs without
+// that limit.
+class MergeSlotObjects {
+public:
+    virtual ~MergeSlotObjects() = default;
+    virtual SlotWait WaitSession(uint32_t timeoutMs) = 0;
+    virtual void ReleaseSession() = 0;
+    // Waits for any one slot of the class and reports which one was taken.
+    virtual SlotWait WaitAnySlot(bool background, uint32_t timeoutMs, size_t& index) = 0;
+    virtual void ReleaseSlot(bool background, size_t index) = 0;
+    virtual uint32_t NowMs() = 0;
+};
+
+enum class MergeSlotStatus { Acquired, SessionBusy, BackgroundSlotTimeout, SlotTimeout };
+
+class MergeSlotHolder {
+public:
+    explicit MergeSlotHolder(MergeSlotObjects& objects) : objects_(objects) {}
+    ~MergeSlotHolder() { Release(); }
+    MergeSlotHolder(const MergeSlotHolder&) = delete;
+    MergeSlotHolder& operator=(const MergeSlotHolder&) = delete;
+
+    // Takes the session lock, then a background slot (background merges only), then a global slot,
+    // all within timeoutMs. On failure whatever was taken is released again.
+    MergeSlotStatus Acquire(bool background, uint32_t timeoutMs) {
+        uint32_t start = objects_.NowMs();
+        auto remaining = [&]() -> uint32_t {
+            uint32_t elapsed = objects_.NowMs() - start;
+            return elapsed >= timeoutMs ? 0 : timeoutMs - elapsed;
+        };
+
+        MergeSlotStatus status = MergeSlotStatus::Acquired;
+        SlotWait wait = objects_.WaitSession(remaining());
+        if (!Held(wait, holdsSession_)) {
+            status = MergeSlotStatus::SessionBusy;
+        }
+        if (status == MergeSlotStatus::Acquired && background) {
+            wait = objects_.WaitAnySlot(true, remaining(), backgroundSlot_);
+            if (!Held(wait, holdsBackground_) && wait != SlotWait::Unavailable) {
+                status = MergeSlotStatus::BackgroundSlotTimeout;
+            }
+            backgroundCapped_ = wait != SlotWait::Unavailable;
+        }
+        if (status == MergeSlotStatus::Acquired) {
+            wait = objects_.WaitAnySlot(false, remaining(), globalSlot_);
+            if (!Held(wait, holdsGlobal_) && wait != SlotWait::Unavailable) {
+                status = MergeSlotStatus::SlotTimeout;
+            }
+            globalCapped_ = wait != SlotWait::Unavailable;
+        }
+
+        waitMs_ = objects_.NowMs() - start;
+        if (status != MergeSlotStatus::Acquired) {
+            Release();
+            return status;
+        }
+        acquired_ = true;
+        acquiredAt_ = objects_.NowMs();
+        return status;
+    }
+
+    // Releases in the reverse order of Acquire.
+    void Release() {
+        if (holdsGlobal_) objects_.ReleaseSlot(false, globalSlot_);
+        if (holdsBackground_) objects_.ReleaseSlot(true, backgroundSlot_);
+        if (holdsSession_) objects_.ReleaseSession();
+        holdsGlobal_ = holdsBackground_ = holdsSession_ = false;
+        if (acquired_) {
+            heldMs_ = objects_.NowMs() - acquiredAt_;
+            acquired_ = false;
+        }
+    }
+
+    uint32_t WaitMs() const { return waitMs_; }
+    uint32_t HeldMs() const { return heldMs_; }
+    // Slots (or the session lock) taken over from a merge that exited without releasing them.
+    size_t Abandoned() const { return abandoned_; }
+    // False when the slots of that class could not be opened and the merge runs without the cap.
+    bool GlobalCapped() const { return globalCapped_; }
+    bool BackgroundCapped() const { return backgroundCapped_; }
+
+private:
+    bool Held(SlotWait wait, bool& held) {
+        held = wait == SlotWait::Acquired || wait == SlotWait::Abandoned;
+        if (wait == SlotWait::Abandoned) ++abandoned_;
+        return held;
+    }
+
+    MergeSlotObjects& objects_;
+    size_t globalSlot_ = 0;
+    size_t backgroundSlot_ = 0;
+    bool holdsSession_ = false;
+    bool holdsGlobal_ = false;
+    bool holdsBackground_ = false;
+    bool globalCapped_ = true;
+    bool backgroundCapped_ = true;
+    bool acquired_ = false;
+    uint32_t acquiredAt_ = 0;
+    uint32_t waitMs_ = 0;
+    uint32_t heldMs_ = 0;
+    size_t abandoned_ = 0;
+};
+
+// --- Slot wait log ---
+// Every merge appends how long it waited for its slot (and whether it got one) to the slot log;
+// --slot-stats reports tail latency per priority class and how evenly the wait is spread across
+// sessions.
+//
+// Slot log format (tab separated, one record per merge):
+//   <session id> <interactive|background> <acquired 0/1> <wait ms> <hold ms>
+static const size_t kSlotStatsWindow = 10000;
+
+struct SlotWaitSample {
+    uint32_t session;
+    bool background;
+    bool acquired;
+    double waitMs;
+};
+
+inline std::string FormatSlotLogRecord(uint32_t session, bool background, bool acquired, uint32_t waitMs, uint32_t holdMs) {
+    return std::to_string(session) + "\t" + (background ? "background" : "interactive") + "\t" + (acquired ? "1" : "0") + "\t" +
+           std::to_string(waitMs) + "\t" + std::to_string(holdMs) + "\n";
+}
+
+inline bool ParseSlotLogRecord(const std::string& line, SlotWaitSample& sample) {
+    std::istringstream ls(line);
+    std::string priority;
+    int acquired = 0;
+    double holdMs = 0.0;
+    if (!(ls >> sample.session >> priority >> acquired >> sample.waitMs >> holdMs)) {
+        return false;
+    }
+    sample.background = priority == "background";
+    sample.acquired = acquired != 0;
+    return true;
+}
+
+inline double Percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t)(p * values.size() + 0.999999);
+    return values[std::min(values.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+// Jain's fairness index over the mean wait of each session: 1.0 when every session waits equally
+// long, approaching 1/n when one session absorbs all the waiting.
+inline double SlotWaitFairness(const std::vector<SlotWaitSample>& samples, uint32_t& worstSession, double& worstMeanMs) {
+    std::map<uint32_t, std::pair<double, size_t>> perSession;
+    for (const auto& s : samples) {
+        auto& entry = perSession[s.session];
+        entry.first += s.waitMs;
+        ++entry.second;
+    }
+    double sum = 0.0, sumSquares = 0.0;
+    worstSession = 0;
+    worstMeanMs = 0.0;
+    for (const auto& entry : perSession) {
+        double mean = entry.second.first / entry.second.second;
+        sum += mean;
+        sumSquares += mean * mean;
+        if (mean >= worstMeanMs) {
+            worstMeanMs = mean;
+            worstSession = entry.first;
+        }
+    }
+    return sumSquares > 0.0 ? sum * sum / (perSession.size() * sumSquares) : 1.0;
+}
+
+inline void PrintSlotStats(const std::vector<SlotWaitSample>& samples, std::ostream& out) {
+    for (bool background : { false, true }) {
+        std::vector<double> waits;
+        size_t timedOut = 0;
+        for (const auto& s : samples) {
+            if (s.background != background) continue;
+            waits.push_back(s.waitMs);
+            if (!s.acquired) ++timedOut;
+        }
+        out << "[slots] " << (background ? "background" : "interactive") << ": " << waits.size() << " merge(s), "
+            << timedOut << " timed out";
+        if (!waits.empty()) {
+            out << "; wait p50 " << (long)Percentile(waits, 0.50) << " ms, p95 " << (long)Percentile(waits, 0.95)
+                << " ms, p99 " << (long)Percentile(waits, 0.99) << " ms, max "
+                << (long)*std::max_element(waits.begin(), waits.end()) << " ms";
+        }
+        out << "\n";
+    }
+
+    if (!samples.empty()) {
+        uint32_t worstSession = 0;
+        double worstMeanMs = 0.0;
+        double fairness = SlotWaitFairness(samples, worstSession, worstMeanMs);
+        std::set<uint32_t> sessions;
+        for (const auto& s : samples) sessions.insert(s.session);
+        out << "[slots] fairness across " << sessions.size() << " session(s): " << std::fixed << std::setprecision(2)
+            << fairness << std::defaultfloat << " (longest mean wait " << (long)worstMeanMs << " ms in session "
+            << worstSession << ")\n";
+    }
+}
@@ -1,6 +1,7 @@
 // merge_tabs.cpp - Merge Explorer tabs into the first window (ANSI, MinGW-w64 friendly)
-// Build: g++ merge_tabs.cpp -std=c++17 -lole32 -loleaut32 -lshell32 -lshlwapi -luuid -luser32 -o merge_tabs.exe
+// Build: g++ merge_tabs.cpp -std=c++20 -lole32 -loleaut32 -lshell32 -lshlwapi -luuid -luser32 -ladvapi32 -o merge_tabs.exe
 
+#define _WIN32_WINNT 0x0601
 #define _WIN32_IE 0x0700
 #define _WIN32_DCOM
 
@@ -11,21 +12,68 @@
 #include <shldisp.h>
 #include <servprov.h>
 #include <oleauto.h>
+#include <ocidl.h>
+#include <shlwapi.h>
+#include <exdispid.h>
+#include <sddl.h>
 
 #include <vector>
 #include <string>
 #include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <memory>
+#include <cctype>
+#include <cmath>
+
+#include "com_ptr.h"
+#include "location_key.h"
+#include "merge_journal.h"
+#include "merge_scheduler.h"
+#include "new_tab_lock.h"
+#include "shell_trace.h"
+#include "tab_engine.h"
 
 static const UINT WM_COMMAND_ID_NEW_TAB = 0xA21B; // same as newtab.cpp (undocumented)
 
 static std::string BSTRtoAnsi(BSTR b);
 
+// Interfaces held in a ComPtr, named for the reference accounting (see com_ptr.h).
+#ifdef TAB_MERGER_COM_ACCOUNTING
+TAB_MERGER_COM_INTERFACE(IDispatch)
+TAB_MERGER_COM_INTERFACE(IShellWindows)
+TAB_MERGER_COM_INTERFACE(IWebBrowser2)
+TAB_MERGER_COM_INTERFACE(IServiceProvider)
+TAB_MERGER_COM_INTERFACE(IShellBrowser)
+TAB_MERGER_COM_INTERFACE(IConnectionPointContainer)
+TAB_MERGER_COM_INTERFACE(IConnectionPoint)
+#endif
+
+// Initializes COM for the thread for the lifetime of the object. Declare it before any ComPtr so
+// every reference is released before COM is uninitialized.
+class ComApartment {
+public:
+    ComApartment() : hr_(CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED)) {}
+    ~ComApartment() {
+        if (SUCCEEDED(hr_)) CoUninitialize();
+    }
+    ComApartment(const ComApartment&) = delete;
+    ComApartment& operator=(const ComApartment&) = delete;
+
+    HRESULT Result() const { return hr_; }
+
+private:
+    HRESULT hr_;
+};
+
 struct TabInfo {
-    IWebBrowser2* browser; // holds one reference; caller must Release
+    ComPtr<IWebBrowser2> browser; // empty while replaying
     std::string url;
-    HWND topLevel;
+    HWND topLevel = nullptr;
+    uintptr_t id = 0; // stable identity of the tab (browser pointer, or recorded value while replaying)
 };
 
 static bool GetDispatchProperty(IDispatch* disp, const wchar_t* name, VARIANT* result) {
@@ -61,51 +109,43 @@ static std::string ExtractExplorerUrl(IWebBrowser2* wb) {
         return url;
     }
 
-    IDispatch* doc = nullptr;
-    if (FAILED(wb->get_Document(&doc)) || !doc) {
+    ComPtr<IDispatch> doc;
+    if (FAILED(wb->get_Document(doc.Put())) || !doc) {
         return url;
     }
 
     VARIANT vFolder;
-    if (!GetDispatchProperty(doc, L"Folder", &vFolder)) {
-        doc->Release();
+    if (!GetDispatchProperty(doc.Get(), L"Folder", &vFolder)) {
         return url;
     }
 
-    IDispatch* folder = nullptr;
+    ComPtr<IDispatch> folder;
     if (vFolder.vt == VT_DISPATCH && vFolder.pdispVal) {
-        folder = vFolder.pdispVal;
-        folder->AddRef();
+        folder.Assign(vFolder.pdispVal);
     }
     VariantClear(&vFolder);
 
     if (!folder) {
-        doc->Release();
         return url;
     }
 
     VARIANT vSelf;
-    if (!GetDispatchProperty(folder, L"Self", &vSelf)) {
-        folder->Release();
-        doc->Release();
+    if (!GetDispatchProperty(folder.Get(), L"Self", &vSelf)) {
         return url;
     }
 
-    IDispatch* selfDisp = nullptr;
+    ComPtr<IDispatch> selfDisp;
     if (vSelf.vt == VT_DISPATCH && vSelf.pdispVal) {
-        selfDisp = vSelf.pdispVal;
-        selfDisp->AddRef();
+        selfDisp.Assign(vSelf.pdispVal);
     }
     VariantClear(&vSelf);
 
     if (!selfDisp) {
-        folder->Release();
-        doc->Release();
         return url;
     }
 
     VARIANT vPath;
-    if (GetDispatchProperty(selfDisp, L"Path", &vPath)) {
+    if (GetDispatchProperty(selfDisp.Get(), L"Path", &vPath)) {
         if (vPath.vt == VT_BSTR && vPath.bstrVal) {
             std::string path = BSTRtoAnsi(vPath.bstrVal);
             if (!path.empty()) {
@@ -119,10 +159,6 @@ static std::string ExtractExplorerUrl(IWebBrowser2* wb) {
         VariantClear(&vPath);
     }
 
-    selfDisp->Release();
-    folder->Release();
-    doc->Release();
-
     return url;
 }
 
@@ -165,19 +201,24 @@ static HRESULT NavigateBrowser(IWebBrowser2* wb, const std::string& url) {
     return hr;
 }
 
+// --- Shell interaction trace (see shell_trace.h) ---
+// The calls merge_tabs makes outside the tab engine (the first enumeration, the tab host lookup
+// and WM_CLOSE) are traced by the wrappers below; the engine's calls go through TracedTabShell.
+static SteadyTraceClock g_traceClock;
+static ShellTrace g_trace(g_traceClock);
+
 // --- Collect Explorer tabs ---
-static bool CollectExplorerTabs(std::vector<TabInfo>& tabs, std::vector<HWND>& windowOrder) {
+static bool EnumerateShellTabs(std::vector<TabInfo>& tabs, std::vector<HWND>& windowOrder) {
     tabs.clear();
     windowOrder.clear();
 
-    IShellWindows* pSW = nullptr;
-    if (FAILED(CoCreateInstance(CLSID_ShellWindows, nullptr, CLSCTX_ALL, IID_PPV_ARGS(&pSW)))) {
+    ComPtr<IShellWindows> pSW;
+    if (FAILED(CoCreateInstance(CLSID_ShellWindows, nullptr, CLSCTX_ALL, IID_IShellWindows, pSW.Put()))) {
         return false;
     }
 
     long count = 0;
     if (FAILED(pSW->get_Count(&count))) {
-        pSW->Release();
         return false;
     }
 
@@ -186,32 +227,27 @@ static bool CollectExplorerTabs(std::vector<TabInfo>& tabs, std::vector<HWND>& w
         vIdx.vt = VT_I4;
         vIdx.lVal = i;
 
-        IDispatch* pDisp = nullptr;
-        if (FAILED(pSW->Item(vIdx, &pDisp)) || !pDisp) {
-            VariantClear(&vIdx);
+        ComPtr<IDispatch> pDisp;
+        HRESULT hr = pSW->Item(vIdx, pDisp.Put());
+        VariantClear(&vIdx);
+        if (FAILED(hr) || !pDisp) {
             continue;
         }
-        VariantClear(&vIdx);
 
-        IWebBrowser2* pWB = nullptr;
-        if (FAILED(pDisp->QueryInterface(IID_IWebBrowser2, (void**)&pWB)) || !pWB) {
-            pDisp->Release();
+        ComPtr<IWebBrowser2> pWB;
+        if (FAILED(pDisp->QueryInterface(IID_IWebBrowser2, pWB.Put())) || !pWB) {
             continue;
         }
-        pDisp->Release();
 
         bool isExplorer = false;
-        IServiceProvider* sp = nullptr;
-        if (SUCCEEDED(pWB->QueryInterface(IID_IServiceProvider, (void**)&sp)) && sp) {
-            IShellBrowser* sb = nullptr;
-            if (SUCCEEDED(sp->QueryService(SID_STopLevelBrowser, IID_PPV_ARGS(&sb))) && sb) {
+        ComPtr<IServiceProvider> sp;
+        if (SUCCEEDED(pWB->QueryInterface(IID_IServiceProvider, sp.Put())) && sp) {
+            ComPtr<IShellBrowser> sb;
+            if (SUCCEEDED(sp->QueryService(SID_STopLevelBrowser, IID_IShellBrowser, sb.Put())) && sb) {
                 isExplorer = true;
-                sb->Release();
             }
-            sp->Release();
         }
         if (!isExplorer) {
-            pWB->Release();
             continue;
         }
 
@@ -221,11 +257,10 @@ static bool CollectExplorerTabs(std::vector<TabInfo>& tabs, std::vector<HWND>& w
             topLevel = (HWND)handle;
         }
         if (!topLevel) {
-            pWB->Release();
             continue;
         }
 
-        std::string url = ExtractExplorerUrl(pWB);
+        std::string url = ExtractExplorerUrl(pWB.Get());
 
         if (std::find(windowOrder.begin(), windowOrder.end(), topLevel) == windowOrder.end()) {
             windowOrder.push_back(topLevel);
@@ -233,16 +268,79 @@ static bool CollectExplorerTabs(std::vector<TabInfo>& tabs, std::vector<HWND>& w
 
         std::cout << "[debug] Explorer tab found: top-level HWND=0x" << std::hex << std::setw(0)
                   << reinterpret_cast<uintptr_t>(topLevel)
-                  << ", IWebBrowser2=" << pWB
+                  << ", IWebBrowser2=" << pWB.Get()
                   << ", URL=" << url << std::dec << "\n";
 
-        tabs.push_back({ pWB, url, topLevel });
+        TabInfo tab;
+        tab.id = reinterpret_cast<uintptr_t>(pWB.Get());
+        tab.browser = std::move(pWB);
+        tab.url = url;
+        tab.topLevel = topLevel;
+        tabs.push_back(std::move(tab));
     }
 
-    pSW->Release();
     return true;
 }
 
+static bool ReplayCollectExplorerTabs(std::vector<TabInfo>& tabs, std::vector<HWND>& windowOrder) {
+    tabs.clear();
+    windowOrder.clear();
+    const TraceSnapshot* snapshot = g_trace.ReplayCollect();
+    if (!snapshot) {
+        return false;
+    }
+
+    for (const auto& t : snapshot->tabs) {
+        HWND topLevel = (HWND)t.window;
+        if (std::find(windowOrder.begin(), windowOrder.end(), topLevel) == windowOrder.end()) {
+            windowOrder.push_back(topLevel);
+        }
+        std::cout << "[debug] Explorer tab found: top-level HWND=0x" << std::hex << std::setw(0)
+                  << t.window
+                  << ", tab id=" << t.id
+                  << ", URL=" << t.url << std::dec << "\n";
+        TabInfo tab;
+        tab.url = t.url;
+        tab.topLevel = topLevel;
+        tab.id = t.id;
+        tabs.push_back(std::move(tab));
+    }
+    return snapshot->ok;
+}
+
+static bool CollectExplorerTabs(std::vector<TabInfo>& tabs, std::vector<HWND>& windowOrder) {
+    if (g_trace.Mode() == TraceMode::Replay) {
+        return ReplayCollectExplorerTabs(tabs, windowOrder);
+    }
+
+    double startMs = g_trace.NowMs();
+    bool ok = EnumerateShellTabs(tabs, windowOrder);
+    if (g_trace.Mode() == TraceMode::Record) {
+        std::vector<ShellTab> recorded;
+        for (const auto& t : tabs) {
+            recorded.push_back({ t.id, reinterpret_cast<uintptr_t>(t.topLevel), t.url });
+        }
+        g_trace.RecordCollect(startMs, ok, recorded);
+    }
+    return ok;
+}
+
+static LRESULT SendShellMessage(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    if (g_trace.Mode() == TraceMode::Replay) {
+        long long result = 0;
+        g_trace.ReplayCall("send", reinterpret_cast<uintptr_t>(hwnd), result);
+        return (LRESULT)result;
+    }
+
+    double startMs = g_trace.NowMs();
+    LRESULT result = SendMessageA(hwnd, msg, wParam, lParam);
+    if (g_trace.Mode() == TraceMode::Record) {
+        g_trace.RecordCall("send", startMs, reinterpret_cast<uintptr_t>(hwnd), result,
+                           std::to_string(msg) + " " + std::to_string(wParam));
+    }
+    return result;
+}
+
 // --- Find ShellTabWindowClass inside a top-level Explorer window ---
 struct FindTabHostData {
     HWND target;
@@ -263,131 +361,662 @@ static BOOL CALLBACK EnumFindTabHost(HWND hwnd, LPARAM lParam) {
 }
 
 static HWND FindShellTabHost(HWND topLevel) {
+    if (g_trace.Mode() == TraceMode::Replay) {
+        long long result = 0;
+        g_trace.ReplayCall("tabhost", reinterpret_cast<uintptr_t>(topLevel), result);
+        return (HWND)(uintptr_t)result;
+    }
+
+    double startMs = g_trace.NowMs();
     FindTabHostData data{};
     EnumChildWindows(topLevel, EnumFindTabHost, reinterpret_cast<LPARAM>(&data));
+    if (g_trace.Mode() == TraceMode::Record) {
+        g_trace.RecordCall("tabhost", startMs, reinterpret_cast<uintptr_t>(topLevel),
+                           (long long)reinterpret_cast<uintptr_t>(data.target), std::string());
+    }
     return data.target;
 }
 
-// --- Create new tab in the first window and navigate ---
-static bool CreateTabAndNavigate(HWND firstWindow, HWND tabHost, const std::string& url, size_t& knownTabCount) {
-    if (!firstWindow || !tabHost || url.empty()) return false;
-
-    size_t baselineCount = knownTabCount;
-    std::vector<TabInfo> baselineTabs;
-    std::vector<HWND> beforeWindows;
-    if (CollectExplorerTabs(baselineTabs, beforeWindows)) {
-        size_t currentCount = 0;
-        for (auto& t : baselineTabs) {
-            if (t.topLevel == firstWindow) {
-                ++currentCount;
+// --- Merge journal (see merge_journal.h) ---
+struct MergeItem {
+    std::string url;
+    HWND donor;
+};
+
+// Per-user state lives in %LOCALAPPDATA%\ExplorerTabMerger (or the temp directory without it).
+static std::string UserDataDirectory() {
+    char dir[MAX_PATH] = {0};
+    DWORD len = GetEnvironmentVariableA("LOCALAPPDATA", dir, MAX_PATH);
+    std::string path;
+    if (len > 0 && len < MAX_PATH) {
+        path = std::string(dir, len) + "\\ExplorerTabMerger";
+        CreateDirectoryA(path.c_str(), nullptr);
+    } else {
+        len = GetTempPathA(MAX_PATH, dir);
+        path = std::string(dir, len);
+        while (!path.empty() && path.back() == '\\') path.pop_back();
+    }
+    return path;
+}
+
+static DWORD CurrentSessionId() {
+    DWORD sessionId = 0;
+    ProcessIdToSessionId(GetCurrentProcessId(), &sessionId);
+    return sessionId;
+}
+
+static std::string MergeJournalPath() {
+    return UserDataDirectory() + "\\merge-" + std::to_string(CurrentSessionId()) + ".journal";
+}
+
+// --- Navigation completion ---
+// Navigate2 returns as soon as the request is accepted. NavigationWatch listens to the tab's
+// DWebBrowserEvents2: each NavigateComplete2 makes it read the tab's own location and report the
+// navigation as complete once that location is the requested one (compared by location key, see
+// location_key.h), and a NavigateError for the requested location reports it as failed. Event
+// URLs are not compared, since the shell reports them in other forms than LocationURL, and a
+// completion that arrives before Navigate2 returns is kept. If the tab does not accept the event
+// sink, completion is detected by polling its ready state and location instead; at the deadline
+// both are checked once more before giving up. Events are delivered while the thread pumps
+// messages.
+
+class NavigationSink : public IDispatch {
+public:
+    explicit NavigationSink(const std::string& key) : key_(key) {}
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override {
+        if (!ppv) return E_POINTER;
+        if (IsEqualIID(riid, IID_IUnknown) || IsEqualIID(riid, IID_IDispatch) || IsEqualIID(riid, DIID_DWebBrowserEvents2)) {
+            *ppv = static_cast<IDispatch*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+    ULONG STDMETHODCALLTYPE AddRef() override { return (ULONG)InterlockedIncrement(&refs_); }
+    ULONG STDMETHODCALLTYPE Release() override {
+        LONG refs = InterlockedDecrement(&refs_);
+        if (refs == 0) delete this;
+        return (ULONG)refs;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetTypeInfoCount(UINT* count) override {
+        if (count) *count = 0;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE GetTypeInfo(UINT, LCID, ITypeInfo**) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetIDsOfNames(REFIID, LPOLESTR*, UINT, LCID, DISPID*) override { return E_NOTIMPL; }
+
+    HRESULT STDMETHODCALLTYPE Invoke(DISPID id, REFIID, LCID, WORD, DISPPARAMS* params, VARIANT*, EXCEPINFO*, UINT*) override {
+        if (!params) {
+            return S_OK;
+        }
+        // Arguments arrive in reverse order: NavigateComplete2(pDisp, URL) and
+        // NavigateError(pDisp, URL, Frame, StatusCode, Cancel).
+        if (id == DISPID_NAVIGATECOMPLETE2) {
+            ++completions_;
+        } else if (id == DISPID_NAVIGATEERROR && params->cArgs >= 5) {
+            if (LocationKeyFromUrl(VariantToAnsi(params->rgvarg[3])) == key_) {
+                const VARIANT& code = params->rgvarg[1];
+                if (code.vt == (VT_BYREF | VT_VARIANT) && code.pvarVal && code.pvarVal->vt == VT_I4) {
+                    error_ = code.pvarVal->lVal;
+                }
+                failed_ = true;
             }
         }
-        baselineCount = currentCount;
-        knownTabCount = currentCount;
-        std::cout << "[debug] Baseline tab count for first window: " << baselineCount << "\n";
+        return S_OK;
+    }
+
+    // Number of NavigateComplete2 events received so far, for any location.
+    unsigned Completions() const { return completions_; }
+    bool Failed() const { return failed_; }
+    long Error() const { return error_; }
+
+private:
+    static std::string VariantToAnsi(const VARIANT& v) {
+        if (v.vt == VT_BSTR) return BSTRtoAnsi(v.bstrVal);
+        if (v.vt == (VT_BYREF | VT_VARIANT) && v.pvarVal && v.pvarVal->vt == VT_BSTR) return BSTRtoAnsi(v.pvarVal->bstrVal);
+        return std::string();
     }
 
-    auto releaseBaselineTabs = [&baselineTabs]() {
-        for (auto& t : baselineTabs) {
-            if (t.browser) {
-                t.browser->Release();
-                t.browser = nullptr;
+    virtual ~NavigationSink() = default;
+
+    LONG refs_ = 1;
+    std::string key_;
+    unsigned completions_ = 0;
+    bool failed_ = false;
+    long error_ = 0;
+};
+
+#ifdef TAB_MERGER_COM_ACCOUNTING
+TAB_MERGER_COM_INTERFACE(NavigationSink)
+#endif
+
+class NavigationWatch {
+public:
+    NavigationWatch(const TabInfo& tab, const std::string& url) : key_(LocationKeyFromUrl(url)) {
+        browser_.Assign(tab.browser.Get());
+    }
+    ~NavigationWatch() {
+        if (point_ && cookie_) point_->Unadvise(cookie_);
+    }
+    NavigationWatch(const NavigationWatch&) = delete;
+    NavigationWatch& operator=(const NavigationWatch&) = delete;
+
+    // Subscribes to the tab's events; call before Navigate2 so no event is missed.
+    void Start() {
+        if (!browser_) {
+            return;
+        }
+        ComPtr<IConnectionPointContainer> container;
+        if (FAILED(browser_->QueryInterface(IID_IConnectionPointContainer, container.Put())) || !container) {
+            return;
+        }
+        if (FAILED(container->FindConnectionPoint(DIID_DWebBrowserEvents2, point_.Put())) || !point_) {
+            return;
+        }
+        sink_.Attach(new NavigationSink(key_));
+        if (FAILED(point_->Advise(static_cast<IDispatch*>(sink_.Get()), &cookie_))) {
+            cookie_ = 0;
+            sink_.Reset();
+        }
+    }
+
+    NavigationStatus Poll() {
+        if (status_ != NavigationStatus::Pending) {
+            return status_;
+        }
+        if (sink_) {
+            if (sink_->Failed()) {
+                status_ = NavigationStatus::Failed;
+            } else if (sink_->Completions() > 0 && AtTarget()) {
+                // The new tab's start page can complete first; it leaves the tab at another location.
+                status_ = NavigationStatus::Complete;
             }
+        } else if (Ready() && AtTarget()) {
+            status_ = NavigationStatus::Complete;
+        }
+        return status_;
+    }
+
+    // Called at the deadline: a navigation whose events were lost still counts if the tab has
+    // finished loading the requested location.
+    NavigationStatus Expire() {
+        if (Poll() != NavigationStatus::Pending) {
+            return status_;
         }
-        baselineTabs.clear();
-    };
+        status_ = Ready() && AtTarget() ? NavigationStatus::Complete : NavigationStatus::Failed;
+        return status_;
+    }
 
-    std::vector<IWebBrowser2*> knownBrowsers;
-    knownBrowsers.reserve(baselineTabs.size());
-    for (auto& t : baselineTabs) {
-        knownBrowsers.push_back(t.browser);
+    long Error() const { return sink_ ? sink_->Error() : 0; }
+
+private:
+    bool Ready() const {
+        READYSTATE state = READYSTATE_UNINITIALIZED;
+        return browser_ && SUCCEEDED(browser_->get_ReadyState(&state)) && state == READYSTATE_COMPLETE;
     }
 
-    std::cout << "[debug] Sending WM_COMMAND to create new tab in HWND=0x" << std::hex
-              << reinterpret_cast<uintptr_t>(tabHost) << std::dec << "\n";
-    SendMessageA(tabHost, WM_COMMAND, (WPARAM)WM_COMMAND_ID_NEW_TAB, 0);
+    bool AtTarget() const {
+        return browser_ && LocationKeyFromUrl(ExtractExplorerUrl(browser_.Get())) == key_;
+    }
 
-    const DWORD timeoutMs = 8000;
-    const DWORD retryMs = 300;
-    DWORD waited = 0;
+    ComPtr<IWebBrowser2> browser_;
+    std::string key_;
+    ComPtr<IConnectionPoint> point_;
+    DWORD cookie_ = 0;
+    ComPtr<NavigationSink> sink_;
+    NavigationStatus status_ = NavigationStatus::Pending;
+};
 
-    bool success = false;
+// --- Tab operations (see tab_engine.h) ---
+// The engine's view of Explorer, wrapped in a TracedTabShell that records or replays its calls.
+// Waiting pumps messages rather than Sleep, so the STA keeps dispatching COM calls and browser
+// events. Ctrl+C cancels the operations that have not sent their new tab request yet.
+static volatile LONG g_cancelRequested = 0;
+
+static BOOL WINAPI CancelOnConsoleSignal(DWORD signal) {
+    if (signal == CTRL_C_EVENT || signal == CTRL_BREAK_EVENT) {
+        g_cancelRequested = 1;
+        std::cerr << "[warn] Cancel requested; finishing tabs already in flight.\n";
+        return TRUE;
+    }
+    return FALSE;
+}
 
-    while (waited <= timeoutMs) {
+// Waits up to timeoutMs while dispatching window messages and incoming COM calls.
+static void PumpMessages(DWORD timeoutMs) {
+    DWORD start = GetTickCount();
+    for (;;) {
+        MSG msg;
+        while (PeekMessageA(&msg, nullptr, 0, 0, PM_REMOVE)) {
+            TranslateMessage(&msg);
+            DispatchMessageA(&msg);
+        }
+        DWORD elapsed = GetTickCount() - start;
+        if (elapsed >= timeoutMs) {
+            return;
+        }
+        if (MsgWaitForMultipleObjects(0, nullptr, FALSE, timeoutMs - elapsed, QS_ALLINPUT) == WAIT_TIMEOUT) {
+            return;
+        }
+    }
+}
+
+class ExplorerTabShell : public TabShell {
+public:
+    explicit ExplorerTabShell(HWND tabHost) : tabHost_(tabHost) {}
+
+    bool EnumerateTabs(std::vector<ShellTab>& out) override {
         std::vector<TabInfo> tabs;
         std::vector<HWND> windows;
-        if (!CollectExplorerTabs(tabs, windows)) {
-            Sleep(retryMs);
-            waited += retryMs;
-            continue;
+        if (!EnumerateShellTabs(tabs, windows)) {
+            return false;
         }
+        for (auto& t : tabs) {
+            out.push_back({ t.id, reinterpret_cast<uintptr_t>(t.topLevel), t.url });
+            // Every tab seen keeps its reference for the whole run, so its browser pointer stays
+            // a unique identity.
+            tabs_.emplace(t.id, std::move(t));
+        }
+        return true;
+    }
 
-        IWebBrowser2* candidateBrowser = nullptr;
-        size_t currentCount = 0;
+    void RequestNewTab() override {
+        std::cout << "[debug] Sending WM_COMMAND to create new tab in HWND=0x" << std::hex
+                  << reinterpret_cast<uintptr_t>(tabHost_) << std::dec << "\n";
+        SendMessageA(tabHost_, WM_COMMAND, (WPARAM)WM_COMMAND_ID_NEW_TAB, 0);
+    }
 
-        for (auto& t : tabs) {
-            if (t.topLevel != firstWindow) {
-                continue;
-            }
+    long Navigate(uintptr_t id, const std::string& url) override {
+        auto tab = tabs_.find(id);
+        if (tab == tabs_.end()) {
+            return E_FAIL;
+        }
+        std::unique_ptr<NavigationWatch> watch(new NavigationWatch(tab->second, url));
+        watch->Start();
+        HRESULT hr = NavigateBrowser(tab->second.browser.Get(), url);
+        if (SUCCEEDED(hr)) {
+            watches_[id] = std::move(watch);
+        }
+        return hr;
+    }
+
+    NavigationPoll PollNavigation(uintptr_t id, bool deadline) override {
+        auto watch = watches_.find(id);
+        if (watch == watches_.end()) {
+            return { NavigationStatus::Failed, 0 };
+        }
+        NavigationPoll poll = { deadline ? watch->second->Expire() : watch->second->Poll(), watch->second->Error() };
+        if (poll.status != NavigationStatus::Pending) {
+            watches_.erase(watch);
+        }
+        return poll;
+    }
 
-            ++currentCount;
+    // Closes a tab whose navigation failed, so a failed merge does not leave a stray tab behind.
+    long QuitTab(uintptr_t id) override {
+        watches_.erase(id);
+        auto tab = tabs_.find(id);
+        return tab != tabs_.end() && tab->second.browser ? tab->second.browser->Quit() : E_POINTER;
+    }
 
-            bool isKnown = false;
-            for (auto* known : knownBrowsers) {
-                if (known == t.browser) {
-                    isKnown = true;
-                    break;
-                }
-            }
+    bool TryLockNewTabs() override { return lock_.Acquire(0); }
+    void UnlockNewTabs() override { lock_.Release(); }
 
-            if (!isKnown && !candidateBrowser) {
-                candidateBrowser = t.browser;
-            }
+    double NowMs() override { return g_trace.NowMs(); }
+    void WaitForEvents(double ms) override { PumpMessages((DWORD)std::ceil(ms)); }
+    bool CancelRequested() override { return g_cancelRequested != 0; }
+
+private:
+    HWND tabHost_;
+    NewTabLock lock_;
+    std::map<uintptr_t, TabInfo> tabs_;
+    std::map<uintptr_t, std::unique_ptr<NavigationWatch>> watches_;
+};
+
+// Journals each tab as soon as it exists and again once it has reached its location.
+class JournalProgress : public TabProgress {
+public:
+    explicit JournalProgress(MergeJournal& journal) : journal_(journal) {}
+    void Created(const TabOperation& op) override { journal_.Created(op.journalIndex); }
+    void Navigated(const TabOperation& op) override { journal_.Navigated(op.journalIndex); }
+
+private:
+    MergeJournal& journal_;
+};
+
+// --- Session and host-wide merge scheduling (see merge_scheduler.h) ---
+// The session lock is a mutex in the session namespace; each host-wide slot is a mutex of its own
+// in the Global namespace, named after its class and number, and a merge waits for any one of them
+// with a single WaitForMultipleObjects. Background merges also run at background priority.
+//
+// Standard users may not create objects in the Global namespace, so on a terminal server the slot
+// mutexes are created by `merge_tabs.exe --host-slots`, started as SYSTEM at boot. It grants every
+// signed-in user the right to wait on and release a slot, and creates the shared slot log.
+static const char* kSessionMergeMutex = "Local\\ExplorerTabMerger.Merge";
+static const char* kGlobalMergeSlotPrefix = "Global\\ExplorerTabMerger.MergeSlot";
+static const char* kBackgroundMergeSlotPrefix = "Global\\ExplorerTabMerger.BackgroundMergeSlot";
+static const DWORD kInteractiveSlotWaitMs = 60000;
+static const DWORD kBackgroundSlotWaitMs = 300000;
+
+// SYSTEM and administrators get full control; Authenticated Users may wait on and release a slot
+// (SYNCHRONIZE | MUTEX_MODIFY_STATE), or read and append to the slot log.
+static const char* kSlotMutexSddl = "D:P(A;;GA;;;SY)(A;;GA;;;BA)(A;;0x100001;;;AU)";
+static const char* kSlotLogSddl = "D:P(A;;FA;;;SY)(A;;FA;;;BA)(A;;0x12008D;;;AU)";
+
+class SharedObjectSecurity {
+public:
+    explicit SharedObjectSecurity(const char* sddl) {
+        if (ConvertStringSecurityDescriptorToSecurityDescriptorA(sddl, SDDL_REVISION_1, &descriptor_, nullptr)) {
+            attributes_.nLength = sizeof(attributes_);
+            attributes_.lpSecurityDescriptor = descriptor_;
+            attributes_.bInheritHandle = FALSE;
         }
+    }
+    ~SharedObjectSecurity() {
+        if (descriptor_) LocalFree(descriptor_);
+    }
+    SharedObjectSecurity(const SharedObjectSecurity&) = delete;
+    SharedObjectSecurity& operator=(const SharedObjectSecurity&) = delete;
 
-        if (candidateBrowser && currentCount > baselineCount) {
-            std::cout << "[debug] Identified new tab by IWebBrowser2 pointer (" << candidateBrowser
-                      << ") in HWND=0x" << std::hex
-                      << reinterpret_cast<uintptr_t>(firstWindow) << std::dec << "\n";
+    SECURITY_ATTRIBUTES* Get() { return descriptor_ ? &attributes_ : nullptr; }
 
-            HRESULT navHr = NavigateBrowser(candidateBrowser, url);
+private:
+    PSECURITY_DESCRIPTOR descriptor_ = nullptr;
+    SECURITY_ATTRIBUTES attributes_{};
+};
 
-            for (auto& t : tabs) {
-                if (t.browser && t.browser != candidateBrowser) {
-                    t.browser->Release();
-                }
-            }
+static MergeSlotCounts HostSlotCounts() {
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    return HostSlotCounts((unsigned)si.dwNumberOfProcessors);
+}
 
-            if (SUCCEEDED(navHr)) {
-                knownTabCount = currentCount;
-                baselineCount = currentCount;
-                std::cout << "[debug] Navigation succeeded for new tab.\n";
-                success = true;
-            }
+static std::string SlotMutexName(bool background, size_t index) {
+    return std::string(background ? kBackgroundMergeSlotPrefix : kGlobalMergeSlotPrefix) + std::to_string(index);
+}
 
-            candidateBrowser->Release();
-            break;
+// Opens the slot mutexes of one class, or creates them when this process is allowed to. A class
+// with any slot missing is not used at all, so its cap is never silently smaller.
+static bool OpenSlotMutexes(bool background, size_t count, std::vector<HANDLE>& handles, DWORD& error) {
+    SharedObjectSecurity security(kSlotMutexSddl);
+    for (size_t i = 0; i < count; ++i) {
+        std::string name = SlotMutexName(background, i);
+        HANDLE h = OpenMutexA(SYNCHRONIZE | MUTEX_MODIFY_STATE, FALSE, name.c_str());
+        if (!h) {
+            h = CreateMutexA(security.Get(), FALSE, name.c_str());
+        }
+        if (!h) {
+            error = GetLastError();
+            for (HANDLE opened : handles) CloseHandle(opened);
+            handles.clear();
+            return false;
         }
+        handles.push_back(h);
+    }
+    return true;
+}
 
-        for (auto& t : tabs) {
-            if (t.browser) {
-                t.browser->Release();
+class NamedMergeSlots : public MergeSlotObjects {
+public:
+    ~NamedMergeSlots() {
+        if (session_) CloseHandle(session_);
+        for (bool background : { false, true }) {
+            for (HANDLE h : Slots(background)) CloseHandle(h);
+        }
+    }
+
+    SlotWait WaitSession(uint32_t timeoutMs) override {
+        session_ = CreateMutexA(nullptr, FALSE, kSessionMergeMutex);
+        if (!session_) {
+            return SlotWait::Unavailable;
+        }
+        DWORD wait = WaitForSingleObject(session_, timeoutMs);
+        return wait == WAIT_OBJECT_0 ? SlotWait::Acquired : wait == WAIT_ABANDONED ? SlotWait::Abandoned : SlotWait::TimedOut;
+    }
+
+    void ReleaseSession() override { ReleaseMutex(session_); }
+
+    SlotWait WaitAnySlot(bool background, uint32_t timeoutMs, size_t& index) override {
+        MergeSlotCounts counts = HostSlotCounts();
+        std::vector<HANDLE>& slots = Slots(background);
+        DWORD error = 0;
+        if (!OpenSlotMutexes(background, background ? counts.backgroundSlots : counts.slots, slots, error)) {
+            // The merge still runs, serialized per session only.
+            std::cerr << "[warn] Host-wide merge cap not applied: cannot open " << SlotMutexName(background, 0)
+                      << " (error " << error << "). Run merge_tabs.exe --host-slots as SYSTEM at startup to provide it.\n";
+            return SlotWait::Unavailable;
+        }
+        DWORD wait = WaitForMultipleObjects((DWORD)slots.size(), slots.data(), FALSE, timeoutMs);
+        if (wait < WAIT_OBJECT_0 + slots.size()) {
+            index = wait - WAIT_OBJECT_0;
+            return SlotWait::Acquired;
+        }
+        if (wait >= WAIT_ABANDONED_0 && wait < WAIT_ABANDONED_0 + slots.size()) {
+            index = wait - WAIT_ABANDONED_0;
+            return SlotWait::Abandoned;
+        }
+        return wait == WAIT_TIMEOUT ? SlotWait::TimedOut : SlotWait::Unavailable;
+    }
+
+    void ReleaseSlot(bool background, size_t index) override { ReleaseMutex(Slots(background)[index]); }
+
+    uint32_t NowMs() override { return GetTickCount(); }
+
+private:
+    std::vector<HANDLE>& Slots(bool background) { return background ? backgroundSlots_ : globalSlots_; }
+
+    HANDLE session_ = nullptr;
+    std::vector<HANDLE> globalSlots_;
+    std::vector<HANDLE> backgroundSlots_;
+};
+
+// --- Slot wait log ---
+// Shared by all sessions in %ProgramData%\ExplorerTabMerger when --host-slots created it, or kept
+// per user otherwise (see merge_scheduler.h for the format).
+static const char* kSlotLogName = "\\merge-slots.log";
+static const LONGLONG kUserSlotLogMaxBytes = 1024 * 1024;
+
+static std::string HostSlotLogPath() {
+    char dir[MAX_PATH] = {0};
+    DWORD len = GetEnvironmentVariableA("ProgramData", dir, MAX_PATH);
+    if (len == 0 || len >= MAX_PATH) {
+        return std::string();
+    }
+    return std::string(dir, len) + "\\ExplorerTabMerger" + kSlotLogName;
+}
+
+static void AppendSlotLog(const std::string& record) {
+    HANDLE file = INVALID_HANDLE_VALUE;
+    std::string hostLog = HostSlotLogPath();
+    if (!hostLog.empty()) {
+        file = CreateFileA(hostLog.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    }
+    if (file == INVALID_HANDLE_VALUE) {
+        std::string userLog = UserDataDirectory() + kSlotLogName;
+        WIN32_FILE_ATTRIBUTE_DATA info{};
+        if (GetFileAttributesExA(userLog.c_str(), GetFileExInfoStandard, &info) &&
+            (((LONGLONG)info.nFileSizeHigh << 32) | info.nFileSizeLow) > kUserSlotLogMaxBytes) {
+            DeleteFileA(userLog.c_str());
+        }
+        file = CreateFileA(userLog.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    }
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    // A single append-only write, so records from concurrent merges never interleave.
+    DWORD written = 0;
+    WriteFile(file, record.data(), (DWORD)record.size(), &written, nullptr);
+    CloseHandle(file);
+}
+
+static int PrintSlotStats() {
+    std::string path = HostSlotLogPath();
+    std::ifstream in(path);
+    if (!in) {
+        path = UserDataDirectory() + kSlotLogName;
+        in.open(path);
+    }
+    if (!in) {
+        std::cout << "No merge slot waits recorded yet.\n";
+        return 0;
+    }
+
+    std::vector<SlotWaitSample> samples;
+    std::string line;
+    while (std::getline(in, line)) {
+        SlotWaitSample s{};
+        if (ParseSlotLogRecord(line, s)) {
+            samples.push_back(s);
+        }
+    }
+    if (samples.size() > kSlotStatsWindow) {
+        samples.erase(samples.begin(), samples.end() - kSlotStatsWindow);
+    }
+    std::cout << "[slots] " << samples.size() << " recent merge(s) from " << path << "\n";
+    PrintSlotStats(samples, std::cout);
+    return 0;
+}
+
+// Creates the host-wide slot mutexes and the shared slot log, then keeps them alive until the
+// process is stopped. The mutexes are never waited on here, so every slot stays free.
+static int HostMergeSlots() {
+    MergeSlotCounts counts = HostSlotCounts();
+    SharedObjectSecurity security(kSlotMutexSddl);
+    std::vector<HANDLE> slots;
+    bool existed = false;
+    for (bool background : { false, true }) {
+        size_t count = background ? counts.backgroundSlots : counts.slots;
+        for (size_t i = 0; i < count; ++i) {
+            HANDLE h = CreateMutexA(security.Get(), FALSE, SlotMutexName(background, i).c_str());
+            DWORD error = GetLastError();
+            if (!h) {
+                std::cerr << "Could not create the host-wide merge slots (error " << error
+                          << "); run as SYSTEM or an administrator.\n";
+                return 1;
             }
+            existed = existed || error == ERROR_ALREADY_EXISTS;
+            slots.push_back(h);
         }
+    }
+    if (existed) {
+        std::cerr << "[warn] Merge slots already existed; their access rights were left unchanged.\n";
+    }
 
-        Sleep(retryMs);
-        waited += retryMs;
+    std::string log = HostSlotLogPath();
+    if (!log.empty()) {
+        CreateDirectoryA(log.substr(0, log.find_last_of('\\')).c_str(), nullptr);
+        SharedObjectSecurity logSecurity(kSlotLogSddl);
+        HANDLE file = CreateFileA(log.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, logSecurity.Get(),
+                                  CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            std::cerr << "[warn] Could not create the shared slot log " << log << " (error " << GetLastError() << ").\n";
+        } else {
+            CloseHandle(file);
+        }
+    }
+
+    std::cout << "Holding " << counts.slots << " host-wide merge slot(s), " << counts.backgroundSlots
+              << " of them for background merges.\n";
+    Sleep(INFINITE);
+    return 0;
+}
+
+class MergeSlot {
+public:
+    MergeSlot() : holder_(slots_) {}
+    ~MergeSlot() {
+        holder_.Release();
+        if (background_) {
+            SetPriorityClass(GetCurrentProcess(), PROCESS_MODE_BACKGROUND_END);
+        }
+        if (attempted_) {
+            AppendSlotLog(FormatSlotLogRecord(CurrentSessionId(), background_, acquired_, holder_.WaitMs(), holder_.HeldMs()));
+        }
+    }
+    MergeSlot(const MergeSlot&) = delete;
+    MergeSlot& operator=(const MergeSlot&) = delete;
+
+    bool Acquire(bool background) {
+        background_ = background;
+        attempted_ = true;
+        if (background) {
+            SetPriorityClass(GetCurrentProcess(), PROCESS_MODE_BACKGROUND_BEGIN);
+        }
+
+        MergeSlotStatus status = holder_.Acquire(background, background ? kBackgroundSlotWaitMs : kInteractiveSlotWaitMs);
+        if (status == MergeSlotStatus::SessionBusy) {
+            std::cerr << "[warn] Another merge is still running in this session.\n";
+            return false;
+        }
+        if (status == MergeSlotStatus::BackgroundSlotTimeout) {
+            std::cerr << "[warn] Timed out waiting for a background merge slot.\n";
+            return false;
+        }
+        if (status == MergeSlotStatus::SlotTimeout) {
+            std::cerr << "[warn] Timed out waiting for a merge slot.\n";
+            return false;
+        }
+        if (holder_.Abandoned()) {
+            std::cerr << "[warn] Took over " << holder_.Abandoned()
+                      << " merge slot(s) left behind by a merge that exited without releasing them.\n";
+        }
+        acquired_ = true;
+        std::cout << "[debug] Merge slot acquired after " << holder_.WaitMs() << " ms ("
+                  << (background ? "background" : "interactive") << ").\n";
+        return true;
     }
 
-    releaseBaselineTabs();
+private:
+    NamedMergeSlots slots_;
+    MergeSlotHolder holder_;
+    bool background_ = false;
+    bool attempted_ = false;
+    bool acquired_ = false;
+};
 
-    return success;
+static void PrintUsage() {
+    std::cerr << "Usage: merge_tabs.exe [--background] [--record <trace file> | --replay <trace file>]\n"
+                 "       merge_tabs.exe --host-slots | --slot-stats\n";
 }
 
-int main() {
-    HRESULT hr = CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED);
-    if (FAILED(hr)) {
-        std::cerr << "CoInitializeEx failed: 0x" << std::hex << hr << "\n";
+int main(int argc, char* argv[]) {
+    bool background = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--background") {
+            background = true;
+        } else if (arg == "--host-slots" && argc == 2) {
+            return HostMergeSlots();
+        } else if (arg == "--slot-stats" && argc == 2) {
+            return PrintSlotStats();
+        } else if ((arg == "--record" || arg == "--replay") && i + 1 < argc && g_trace.Mode() == TraceMode::Off) {
+            std::string path = argv[++i];
+            bool opened = arg == "--record" ? g_trace.OpenForRecord(path) : g_trace.LoadForReplay(path);
+            if (!opened) {
+                std::cerr << "Could not open trace file: " << path << "\n";
+                return 1;
+            }
+        } else {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    // A replayed merge never touches the shell, so it does not compete for merge slots.
+    MergeSlot slot;
+    if (g_trace.Mode() != TraceMode::Replay && !slot.Acquire(background)) {
+        return 4;
+    }
+    g_traceClock.Start();
+
+    ComApartment apartment;
+    if (FAILED(apartment.Result())) {
+        std::cerr << "CoInitializeEx failed: 0x" << std::hex << apartment.Result() << "\n";
         return 1;
     }
 
@@ -395,34 +1024,48 @@ int main() {
     std::vector<HWND> windowOrder;
     if (!CollectExplorerTabs(tabs, windowOrder)) {
         std::cerr << "Failed to enumerate Explorer tabs.\n";
-        CoUninitialize();
         return 2;
     }
 
     if (windowOrder.empty()) {
         std::cout << "No Explorer windows detected.\n";
-        for (auto& t : tabs) if (t.browser) t.browser->Release();
-        CoUninitialize();
         return 0;
     }
 
     HWND firstWindow = windowOrder.front();
-    size_t knownTabCount = 0;
-    std::vector<std::string> urlsToMerge;
+    std::vector<MergeItem> urlsToMerge;
     std::vector<HWND> windowsToClose;
 
+    // Replayed merges must not read or clobber the journal of a real one.
+    bool journaling = g_trace.Mode() != TraceMode::Replay;
+    std::string journalPath = journaling ? MergeJournalPath() : std::string();
+    std::vector<JournalItem> alreadyMoved;
+    if (journaling) {
+        alreadyMoved = MergeJournal::LoadMoved(journalPath, reinterpret_cast<uintptr_t>(firstWindow));
+        if (!alreadyMoved.empty()) {
+            std::cout << "Resuming interrupted merge: " << alreadyMoved.size() << " tab(s) already moved.\n";
+        }
+    }
+    std::vector<JournalItem> skipped;
+
     for (auto& t : tabs) {
         if (t.topLevel == firstWindow) {
-            ++knownTabCount;
             std::cout << "[debug] Known tab in first window on startup: HWND=0x" << std::hex
                       << reinterpret_cast<uintptr_t>(t.topLevel)
-                      << ", IWebBrowser2=" << t.browser << std::dec << "\n";
+                      << ", IWebBrowser2=" << t.browser.Get() << std::dec << "\n";
         } else {
-            if (!t.url.empty()) {
-                urlsToMerge.push_back(t.url);
+            auto moved = std::find_if(alreadyMoved.begin(), alreadyMoved.end(), [&t](const JournalItem& m) {
+                return m.donor == reinterpret_cast<uintptr_t>(t.topLevel) && m.url == t.url;
+            });
+            if (moved != alreadyMoved.end()) {
+                skipped.push_back(*moved);
+                alreadyMoved.erase(moved);
+                std::cout << "[debug] Tab already moved by interrupted merge: URL=" << t.url << "\n";
+            } else if (!t.url.empty()) {
+                urlsToMerge.push_back({ t.url, t.topLevel });
                 std::cout << "[debug] Tab queued for merge: HWND=0x" << std::hex
                           << reinterpret_cast<uintptr_t>(t.topLevel)
-                          << ", IWebBrowser2=" << t.browser << std::dec
+                          << ", IWebBrowser2=" << t.browser.Get() << std::dec
                           << ", URL=" << t.url << "\n";
             }
             if (std::find(windowsToClose.begin(), windowsToClose.end(), t.topLevel) == windowsToClose.end()) {
@@ -431,42 +1074,96 @@ int main() {
         }
     }
 
-    for (auto& t : tabs) {
-        if (t.browser) t.browser->Release();
-    }
+    tabs.clear();
 
-    if (urlsToMerge.empty()) {
+    if (urlsToMerge.empty() && skipped.empty()) {
         std::cout << "Nothing to merge.\n";
-        CoUninitialize();
+        if (journaling) DeleteFileA(journalPath.c_str());
         return 0;
     }
 
     HWND tabHost = FindShellTabHost(firstWindow);
     if (!tabHost) {
         std::cerr << "Could not find ShellTabWindowClass in the first window.\n";
-        CoUninitialize();
         return 3;
     }
 
+    // This run appends its own segment; the tabs moved by the interrupted run stay recorded in
+    // the earlier segments, so a second interruption still knows about them.
+    MergeJournal journal;
+    if (journaling) {
+        journal.Open(journalPath, reinterpret_cast<uintptr_t>(firstWindow));
+    }
+    for (size_t i = 0; i < urlsToMerge.size(); ++i) {
+        journal.Planned(i, { urlsToMerge[i].url, reinterpret_cast<uintptr_t>(urlsToMerge[i].donor) });
+    }
+
     std::cout << "Merging " << urlsToMerge.size() << " tab(s) into the first window...\n";
 
+    std::vector<TabOperation> ops(urlsToMerge.size());
+    for (size_t i = 0; i < urlsToMerge.size(); ++i) {
+        ops[i].url = urlsToMerge[i].url;
+        ops[i].donor = reinterpret_cast<uintptr_t>(urlsToMerge[i].donor);
+        ops[i].journalIndex = i;
+    }
+
+    DWORD mergeStart = GetTickCount();
     size_t successCount = 0;
-    for (const auto& url : urlsToMerge) {
-        if (CreateTabAndNavigate(firstWindow, tabHost, url, knownTabCount)) {
-            ++successCount;
+    if (!ops.empty()) {
+        SetConsoleCtrlHandler(CancelOnConsoleSignal, TRUE);
+        ExplorerTabShell explorer(tabHost);
+        TracedTabShell shell(g_trace, &explorer, reinterpret_cast<uintptr_t>(tabHost));
+        JournalProgress progress(journal);
+        TabEngine engine(shell, reinterpret_cast<uintptr_t>(firstWindow), progress);
+        successCount = engine.Run(ops);
+        SetConsoleCtrlHandler(CancelOnConsoleSignal, FALSE);
+    }
+    DWORD mergeMs = GetTickCount() - mergeStart;
+    for (const auto& op : ops) {
+        if (op.state == TabOpState::Navigated) {
+            std::cout << "[latency] " << (long)(op.completedAt - op.requestedAt) << " ms (navigation "
+                      << (long)(op.completedAt - op.navigateStartedAt) << " ms): " << op.url << "\n";
+        } else if (op.state == TabOpState::Canceled) {
+            std::cout << "[canceled] Tab not created for: " << op.url << "\n";
         } else {
-            std::cerr << "[warn] Failed to create tab for: " << url << "\n";
+            std::cerr << "[warn] Failed to create tab for: " << op.url << "\n";
         }
     }
+    if (!ops.empty()) {
+        std::cout << "[throughput] " << successCount << " tab(s) in " << mergeMs << " ms ("
+                  << std::fixed << std::setprecision(1) << (mergeMs ? successCount * 1000.0 / mergeMs : 0.0)
+                  << " tabs/s)\n" << std::defaultfloat;
+    }
 
+    // A donor is closed only when every one of its tabs is confirmed to be open in the first
+    // window. Otherwise the donor and the journal are kept, so the next run resumes with the
+    // tabs that did not make it.
+    bool canceled = std::any_of(ops.begin(), ops.end(), [](const TabOperation& op) {
+        return op.state == TabOpState::Canceled;
+    });
+    bool incomplete = false;
     for (HWND h : windowsToClose) {
-        if (h && h != firstWindow) {
-            SendMessageA(h, WM_CLOSE, 0, 0);
+        bool allMoved = std::all_of(ops.begin(), ops.end(), [h](const TabOperation& op) {
+            return op.donor != reinterpret_cast<uintptr_t>(h) || op.state == TabOpState::Navigated;
+        });
+        if (!allMoved) {
+            incomplete = true;
+            std::cerr << "[warn] Keeping donor window HWND=0x" << std::hex << reinterpret_cast<uintptr_t>(h)
+                      << std::dec << " open: not all of its tabs were moved.\n";
+        } else if (h && h != firstWindow) {
+            SendShellMessage(h, WM_CLOSE, 0, 0);
+            journal.Closed(reinterpret_cast<uintptr_t>(h));
         }
     }
+    if (canceled) {
+        std::cout << "Canceled. " << successCount << " tab(s) moved; run again to resume.\n";
+        return 5;
+    }
+    if (!incomplete) {
+        journal.Finish();
+    }
 
     std::cout << "Completed. " << successCount << " tab(s) moved.\n";
 
-    CoUninitialize();
     return 0;
 }
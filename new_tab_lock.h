@@ -0,0 +1,106 @@
+// new_tab_lock.h - Cross-process new tab protocol shared by the C++ tools
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// --- Cross-process new tab lock ---
+// Sending the new tab command, claiming the first tab that was not in the baseline and navigating
+// it must not interleave with another process doing the same in the session (open_folder_tab or
+// merge_tabs), or each would claim the other's tab. The named mutex serializes that sequence.
+// merge_tabs holds it only while it has new tab requests outstanding, never while it waits for
+// navigations to complete, so a long merge does not keep other processes from opening tabs.
+#ifdef _WIN32
+static const char* kNewTabMutex = "Local\\ExplorerTabMerger.NewTab";
+static const DWORD kNewTabLockWaitMs = 60000;
+
+class NewTabLock {
+public:
+    NewTabLock() : mutex_(CreateMutexA(nullptr, FALSE, kNewTabMutex)) {}
+    ~NewTabLock() {
+        Release();
+        if (mutex_) CloseHandle(mutex_);
+    }
+    NewTabLock(const NewTabLock&) = delete;
+    NewTabLock& operator=(const NewTabLock&) = delete;
+
+    // Without the mutex (creation failed) there is nothing to coordinate with, so proceed.
+    bool Acquire(DWORD timeoutMs) {
+        if (!mutex_ || held_) return true;
+        DWORD wait = WaitForSingleObject(mutex_, timeoutMs);
+        held_ = wait == WAIT_OBJECT_0 || wait == WAIT_ABANDONED;
+        return held_;
+    }
+
+    void Release() {
+        if (held_) {
+            ReleaseMutex(mutex_);
+            held_ = false;
+        }
+    }
+
+private:
+    HANDLE mutex_;
+    bool held_ = false;
+};
+#endif
+
+// --- New tab claims (platform-neutral) ---
+// While the lock is held, the tabs of the first window are recorded before any new tab command is
+// sent; a tab that appears afterwards and is not known yet was created by one of our commands.
+// Tabs are identified by a stable id (the browser pointer, held for as long as the claims are).
+class NewTabClaims {
+public:
+    // Records tabs that are not ours to claim: those present before our commands, or opened by
+    // another process while we did not hold the lock.
+    void AddKnown(const std::vector<uintptr_t>& ids) {
+        for (uintptr_t id : ids) {
+            if (!IsKnown(id)) known_.push_back(id);
+        }
+    }
+
+    bool IsKnown(uintptr_t id) const { return std::find(known_.begin(), known_.end(), id) != known_.end(); }
+
+    // Claims up to max tabs of ids that are not known yet, in enumeration order.
+    std::vector<uintptr_t> Claim(const std::vector<uintptr_t>& ids, size_t max) {
+        std::vector<uintptr_t> claimed;
+        for (uintptr_t id : ids) {
+            if (claimed.size() >= max) break;
+            if (!IsKnown(id)) {
+                known_.push_back(id);
+                claimed.push_back(id);
+            }
+        }
+        return claimed;
+    }
+
+private:
+    std::vector<uintptr_t> known_;
+};
+
+// Sends one new tab command and claims the tab it creates, polling every retryMs for up to
+// timeoutMs. Call it with the lock held and the baseline recorded in claims. Shell provides
+//   bool FirstWindowTabs(std::vector<uintptr_t>& ids)   the ids of the first window's tabs
+//   void RequestNewTab()                                 sends the new tab command
+//   void Wait(uint32_t ms)
+// Returns the id of the claimed tab, or 0 when none appeared in time.
+template <typename Shell>
+uintptr_t RequestAndClaimNewTab(Shell& shell, NewTabClaims& claims, uint32_t timeoutMs, uint32_t retryMs) {
+    shell.RequestNewTab();
+    for (uint32_t waited = 0; waited <= timeoutMs; waited += retryMs) {
+        std::vector<uintptr_t> ids;
+        if (shell.FirstWindowTabs(ids)) {
+            std::vector<uintptr_t> claimed = claims.Claim(ids, 1);
+            if (!claimed.empty()) {
+                return claimed.front();
+            }
+        }
+        shell.Wait(retryMs);
+    }
+    return 0;
+}
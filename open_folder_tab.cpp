@@ -1,6 +1,7 @@
-// open_folder_tab.cpp - Open a folder in a new tab of the first Explorer window, or ShellExecute if none exists
+// open_folder_tab.cpp - Open a folder in a new tab of the first Explorer window (or switch to a tab already showing it), or ShellExecute if none exists
 // Build: g++ open_folder_tab.cpp -std=c++17 -lole32 -loleaut32 -lshell32 -lshlwapi -luuid -luser32 -o open_folder_tab.exe
 
+#define _WIN32_WINNT 0x0601
 #define _WIN32_IE 0x0700
 #define _WIN32_DCOM
 
@@ -11,18 +12,61 @@
 #include <shldisp.h>
 #include <servprov.h>
 #include <oleauto.h>
+#include <shlwapi.h>
+#include <uiautomation.h>
 
 #include <algorithm>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "com_ptr.h"
+#include "folder_paths.h"
+#include "location_key.h"
+#include "new_tab_lock.h"
+
 static const UINT WM_COMMAND_ID_NEW_TAB = 0xA21B; // undocumented new tab command
 
+// Interfaces held in a ComPtr, named for the reference accounting (see com_ptr.h).
+#ifdef TAB_MERGER_COM_ACCOUNTING
+TAB_MERGER_COM_INTERFACE(IDispatch)
+TAB_MERGER_COM_INTERFACE(IShellWindows)
+TAB_MERGER_COM_INTERFACE(IWebBrowser2)
+TAB_MERGER_COM_INTERFACE(IServiceProvider)
+TAB_MERGER_COM_INTERFACE(IShellBrowser)
+TAB_MERGER_COM_INTERFACE(IShellView)
+TAB_MERGER_COM_INTERFACE(IUIAutomation)
+TAB_MERGER_COM_INTERFACE(IUIAutomationElement)
+TAB_MERGER_COM_INTERFACE(IUIAutomationElementArray)
+TAB_MERGER_COM_INTERFACE(IUIAutomationCondition)
+TAB_MERGER_COM_INTERFACE(IUIAutomationSelectionItemPattern)
+#endif
+
+// Initializes COM for the thread for the lifetime of the object. Declare it before any ComPtr so
+// every reference is released before COM is uninitialized.
+class ComApartment {
+public:
+    ComApartment() : hr_(CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED)) {}
+    ~ComApartment() {
+        if (SUCCEEDED(hr_)) CoUninitialize();
+    }
+    ComApartment(const ComApartment&) = delete;
+    ComApartment& operator=(const ComApartment&) = delete;
+
+    HRESULT Result() const { return hr_; }
+
+private:
+    HRESULT hr_;
+};
+
 struct TabInfo {
-    IWebBrowser2* browser; // holds one reference; caller must Release
+    ComPtr<IWebBrowser2> browser;
     std::string url;
-    HWND topLevel;
+    HWND topLevel = nullptr;
 };
 
 static BSTR AnsiToBSTR(const char* s) {
@@ -78,51 +122,43 @@ static std::string ExtractExplorerUrl(IWebBrowser2* wb) {
         return url;
     }
 
-    IDispatch* doc = nullptr;
-    if (FAILED(wb->get_Document(&doc)) || !doc) {
+    ComPtr<IDispatch> doc;
+    if (FAILED(wb->get_Document(doc.Put())) || !doc) {
         return url;
     }
 
     VARIANT vFolder;
-    if (!GetDispatchProperty(doc, L"Folder", &vFolder)) {
-        doc->Release();
+    if (!GetDispatchProperty(doc.Get(), L"Folder", &vFolder)) {
         return url;
     }
 
-    IDispatch* folder = nullptr;
+    ComPtr<IDispatch> folder;
     if (vFolder.vt == VT_DISPATCH && vFolder.pdispVal) {
-        folder = vFolder.pdispVal;
-        folder->AddRef();
+        folder.Assign(vFolder.pdispVal);
     }
     VariantClear(&vFolder);
 
     if (!folder) {
-        doc->Release();
         return url;
     }
 
     VARIANT vSelf;
-    if (!GetDispatchProperty(folder, L"Self", &vSelf)) {
-        folder->Release();
-        doc->Release();
+    if (!GetDispatchProperty(folder.Get(), L"Self", &vSelf)) {
         return url;
     }
 
-    IDispatch* selfDisp = nullptr;
+    ComPtr<IDispatch> selfDisp;
     if (vSelf.vt == VT_DISPATCH && vSelf.pdispVal) {
-        selfDisp = vSelf.pdispVal;
-        selfDisp->AddRef();
+        selfDisp.Assign(vSelf.pdispVal);
     }
     VariantClear(&vSelf);
 
     if (!selfDisp) {
-        folder->Release();
-        doc->Release();
         return url;
     }
 
     VARIANT vPath;
-    if (GetDispatchProperty(selfDisp, L"Path", &vPath)) {
+    if (GetDispatchProperty(selfDisp.Get(), L"Path", &vPath)) {
         if (vPath.vt == VT_BSTR && vPath.bstrVal) {
             std::string path = BSTRtoAnsi(vPath.bstrVal);
             if (!path.empty()) {
@@ -136,10 +172,6 @@ static std::string ExtractExplorerUrl(IWebBrowser2* wb) {
         VariantClear(&vPath);
     }
 
-    selfDisp->Release();
-    folder->Release();
-    doc->Release();
-
     return url;
 }
 
@@ -161,18 +193,20 @@ static HRESULT NavigateBrowser(IWebBrowser2* wb, const std::string& url) {
     return hr;
 }
 
-static bool CollectExplorerTabs(std::vector<TabInfo>& tabs, std::vector<HWND>& windowOrder) {
+// Restricting the enumeration to one window skips the Explorer check for every other window's
+// tabs; withUrls=false skips URL extraction for callers that only need tab identities.
+static bool CollectExplorerTabs(std::vector<TabInfo>& tabs, std::vector<HWND>& windowOrder,
+                                HWND onlyWindow = nullptr, bool withUrls = true) {
     tabs.clear();
     windowOrder.clear();
 
-    IShellWindows* pSW = nullptr;
-    if (FAILED(CoCreateInstance(CLSID_ShellWindows, nullptr, CLSCTX_ALL, IID_PPV_ARGS(&pSW)))) {
+    ComPtr<IShellWindows> pSW;
+    if (FAILED(CoCreateInstance(CLSID_ShellWindows, nullptr, CLSCTX_ALL, IID_IShellWindows, pSW.Put()))) {
         return false;
     }
 
     long count = 0;
     if (FAILED(pSW->get_Count(&count))) {
-        pSW->Release();
         return false;
     }
 
@@ -181,32 +215,15 @@ static bool CollectExplorerTabs(std::vector<TabInfo>& tabs, std::vector<HWND>& w
         vIdx.vt = VT_I4;
         vIdx.lVal = i;
 
-        IDispatch* pDisp = nullptr;
-        if (FAILED(pSW->Item(vIdx, &pDisp)) || !pDisp) {
-            VariantClear(&vIdx);
-            continue;
-        }
+        ComPtr<IDispatch> pDisp;
+        HRESULT hr = pSW->Item(vIdx, pDisp.Put());
         VariantClear(&vIdx);
-
-        IWebBrowser2* pWB = nullptr;
-        if (FAILED(pDisp->QueryInterface(IID_IWebBrowser2, (void**)&pWB)) || !pWB) {
-            pDisp->Release();
+        if (FAILED(hr) || !pDisp) {
             continue;
         }
-        pDisp->Release();
 
-        bool isExplorer = false;
-        IServiceProvider* sp = nullptr;
-        if (SUCCEEDED(pWB->QueryInterface(IID_IServiceProvider, (void**)&sp)) && sp) {
-            IShellBrowser* sb = nullptr;
-            if (SUCCEEDED(sp->QueryService(SID_STopLevelBrowser, IID_PPV_ARGS(&sb))) && sb) {
-                isExplorer = true;
-                sb->Release();
-            }
-            sp->Release();
-        }
-        if (!isExplorer) {
-            pWB->Release();
+        ComPtr<IWebBrowser2> pWB;
+        if (FAILED(pDisp->QueryInterface(IID_IWebBrowser2, pWB.Put())) || !pWB) {
             continue;
         }
 
@@ -215,21 +232,35 @@ static bool CollectExplorerTabs(std::vector<TabInfo>& tabs, std::vector<HWND>& w
         if (SUCCEEDED(pWB->get_HWND(&handle))) {
             topLevel = (HWND)handle;
         }
-        if (!topLevel) {
-            pWB->Release();
+        if (!topLevel || (onlyWindow && topLevel != onlyWindow)) {
+            continue;
+        }
+
+        bool isExplorer = false;
+        ComPtr<IServiceProvider> sp;
+        if (SUCCEEDED(pWB->QueryInterface(IID_IServiceProvider, sp.Put())) && sp) {
+            ComPtr<IShellBrowser> sb;
+            if (SUCCEEDED(sp->QueryService(SID_STopLevelBrowser, IID_IShellBrowser, sb.Put())) && sb) {
+                isExplorer = true;
+            }
+        }
+        if (!isExplorer) {
             continue;
         }
 
-        std::string url = ExtractExplorerUrl(pWB);
+        std::string url = withUrls ? ExtractExplorerUrl(pWB.Get()) : std::string();
 
         if (std::find(windowOrder.begin(), windowOrder.end(), topLevel) == windowOrder.end()) {
             windowOrder.push_back(topLevel);
         }
 
-        tabs.push_back({ pWB, url, topLevel });
+        TabInfo tab;
+        tab.browser = std::move(pWB);
+        tab.url = url;
+        tab.topLevel = topLevel;
+        tabs.push_back(std::move(tab));
     }
 
-    pSW->Release();
     return true;
 }
 
@@ -257,167 +288,497 @@ static HWND FindShellTabHost(HWND topLevel) {
     return data.target;
 }
 
-static bool CreateTabAndNavigate(HWND firstWindow, HWND tabHost, const std::string& url) {
-    if (!firstWindow || !tabHost || url.empty()) return false;
+// Finds the first top-level Explorer window that hosts tabs with a plain window lookup, without
+// going through IShellWindows. FindWindowEx walks windows in Z-order, so this is the front-most
+// Explorer window; merge_tabs merges into the first window of the IShellWindows list instead.
+static bool FindFirstExplorerWindow(HWND& window, HWND& tabHost) {
+    HWND candidate = nullptr;
+    while ((candidate = FindWindowExA(nullptr, candidate, "CabinetWClass", nullptr)) != nullptr) {
+        HWND host = FindShellTabHost(candidate);
+        if (host) {
+            window = candidate;
+            tabHost = host;
+            return true;
+        }
+    }
+    return false;
+}
 
-    std::vector<TabInfo> baselineTabs;
-    std::vector<HWND> beforeWindows;
-    if (!CollectExplorerTabs(baselineTabs, beforeWindows)) {
-        return false;
+// Explorer has no API to select a tab. Each tab has its own ShellTabWindowClass window, found by
+// walking up from the tab's view window, and only the selected tab's one is visible.
+static HWND FindTabWindowOfBrowser(IWebBrowser2* wb) {
+    if (!wb) return nullptr;
+
+    HWND viewWindow = nullptr;
+    ComPtr<IServiceProvider> sp;
+    if (SUCCEEDED(wb->QueryInterface(IID_IServiceProvider, sp.Put())) && sp) {
+        ComPtr<IShellBrowser> sb;
+        if (SUCCEEDED(sp->QueryService(SID_STopLevelBrowser, IID_IShellBrowser, sb.Put())) && sb) {
+            ComPtr<IShellView> view;
+            if (SUCCEEDED(sb->QueryActiveShellView(view.Put())) && view) {
+                view->GetWindow(&viewWindow);
+            }
+        }
     }
 
-    size_t baselineCount = 0;
-    std::vector<IWebBrowser2*> knownBrowsers;
-    for (auto& t : baselineTabs) {
-        if (t.topLevel == firstWindow) {
-            ++baselineCount;
-            knownBrowsers.push_back(t.browser);
+    for (HWND h = viewWindow; h; h = GetParent(h)) {
+        char cls[256] = {0};
+        if (GetClassNameA(h, cls, 255) && std::string(cls) == "ShellTabWindowClass") {
+            return h;
+        }
+    }
+    return nullptr;
+}
+
+// Defined here because not every MinGW-w64 libuuid exports the UI Automation GUIDs.
+static const CLSID kClsidCUIAutomation = { 0xff48dba4, 0x60ef, 0x4201, { 0xaa, 0x87, 0x54, 0x10, 0x3e, 0xef, 0x59, 0x4e } };
+static const IID kIidIUIAutomation = { 0x30cbe57d, 0xd9d0, 0x452a, { 0xab, 0x13, 0x7a, 0xc5, 0xac, 0x48, 0x25, 0xee } };
+static const IID kIidIUIAutomationSelectionItemPattern = { 0xa8efa66a, 0x0fda, 0x421a, { 0x91, 0x94, 0x38, 0x02, 0x1f, 0x35, 0x78, 0xea } };
+static const DWORD kTabSelectTimeoutMs = 500;
+
+static bool WaitForTabWindowVisible(HWND tabWindow, DWORD timeoutMs) {
+    DWORD start = GetTickCount();
+    while (!IsWindowVisible(tabWindow)) {
+        if (GetTickCount() - start >= timeoutMs) {
+            return false;
         }
+        Sleep(10);
     }
+    return true;
+}
 
-    SendMessageA(tabHost, WM_COMMAND, (WPARAM)WM_COMMAND_ID_NEW_TAB, 0);
+// The tab strip exposes every tab to UI Automation as a tab item named after the tab's location,
+// and tab items can be selected through SelectionItemPattern. Tabs with the same name are tried in
+// turn until the tab's own window is the visible one.
+static bool SelectTabWithUIAutomation(HWND topLevel, HWND tabWindow, const std::string& name) {
+    ComPtr<IUIAutomation> automation;
+    if (FAILED(CoCreateInstance(kClsidCUIAutomation, nullptr, CLSCTX_INPROC_SERVER, kIidIUIAutomation,
+                                automation.Put())) || !automation) {
+        return false;
+    }
 
-    const DWORD timeoutMs = 8000;
-    const DWORD retryMs = 300;
-    DWORD waited = 0;
+    ComPtr<IUIAutomationElement> window;
+    if (FAILED(automation->ElementFromHandle(topLevel, window.Put())) || !window) {
+        return false;
+    }
 
-    bool success = false;
+    VARIANT vType; VariantInit(&vType);
+    vType.vt = VT_I4;
+    vType.lVal = UIA_TabItemControlTypeId;
+    ComPtr<IUIAutomationCondition> isTabItem;
+    if (FAILED(automation->CreatePropertyCondition(UIA_ControlTypePropertyId, vType, isTabItem.Put())) || !isTabItem) {
+        return false;
+    }
 
-    while (waited <= timeoutMs) {
-        std::vector<TabInfo> tabs;
-        std::vector<HWND> windows;
-        if (!CollectExplorerTabs(tabs, windows)) {
-            Sleep(retryMs);
-            waited += retryMs;
+    ComPtr<IUIAutomationElementArray> items;
+    if (FAILED(window->FindAll(TreeScope_Descendants, isTabItem.Get(), items.Put())) || !items) {
+        return false;
+    }
+
+    int count = 0;
+    items->get_Length(&count);
+    for (int i = 0; i < count; ++i) {
+        ComPtr<IUIAutomationElement> item;
+        if (FAILED(items->GetElement(i, item.Put())) || !item) {
             continue;
         }
 
-        IWebBrowser2* candidateBrowser = nullptr;
-        size_t currentCount = 0;
+        BSTR bName = nullptr;
+        bool sameName = false;
+        if (SUCCEEDED(item->get_CurrentName(&bName)) && bName) {
+            sameName = BSTRtoAnsi(bName) == name;
+            SysFreeString(bName);
+        }
+        if (!sameName) {
+            continue;
+        }
 
-        for (auto& t : tabs) {
-            if (t.topLevel != firstWindow) {
-                continue;
-            }
+        ComPtr<IUIAutomationSelectionItemPattern> selection;
+        if (FAILED(item->GetCurrentPatternAs(UIA_SelectionItemPatternId, kIidIUIAutomationSelectionItemPattern,
+                                             selection.Put())) || !selection) {
+            continue;
+        }
+        if (SUCCEEDED(selection->Select()) && WaitForTabWindowVisible(tabWindow, kTabSelectTimeoutMs)) {
+            return true;
+        }
+    }
+    return false;
+}
 
-            ++currentCount;
+// Brings the tab's window to the front and selects the tab. No keystrokes are sent, so nothing
+// reaches another application or combines with keys the user is holding.
+static bool ActivateTab(const TabInfo& tab) {
+    HWND topLevel = tab.topLevel;
+    if (IsIconic(topLevel)) {
+        ShowWindow(topLevel, SW_RESTORE);
+    }
+    SetForegroundWindow(topLevel);
 
-            bool isKnown = false;
-            for (auto* known : knownBrowsers) {
-                if (known == t.browser) {
-                    isKnown = true;
-                    break;
-                }
-            }
+    HWND tabWindow = FindTabWindowOfBrowser(tab.browser.Get());
+    if (!tabWindow) {
+        return false;
+    }
+    if (IsWindowVisible(tabWindow)) {
+        return true;
+    }
 
-            if (!isKnown && !candidateBrowser) {
-                candidateBrowser = t.browser;
+    std::string name;
+    BSTR bName = nullptr;
+    if (SUCCEEDED(tab.browser->get_LocationName(&bName)) && bName) {
+        name = BSTRtoAnsi(bName);
+        SysFreeString(bName);
+    }
+    return !name.empty() && SelectTabWithUIAutomation(topLevel, tabWindow, name);
+}
+
+static const DWORD kTabVisibleTimeoutMs = 5000;
+
+// Waits until the tab shows the folder and is the selected tab of its window. The location a
+// shell: target ends up at cannot be predicted, so for those only readiness and selection count.
+static bool WaitUntilTabVisible(IWebBrowser2* wb, const std::string& path) {
+    if (!wb) return false;
+
+    std::string key = LocationKeyFromPath(path);
+    bool checkLocation = key.rfind("shell:", 0) != 0;
+    DWORD start = GetTickCount();
+    for (;;) {
+        READYSTATE state = READYSTATE_UNINITIALIZED;
+        if (SUCCEEDED(wb->get_ReadyState(&state)) && state == READYSTATE_COMPLETE &&
+            (!checkLocation || LocationKeyFromUrl(ExtractExplorerUrl(wb)) == key)) {
+            HWND tabWindow = FindTabWindowOfBrowser(wb);
+            if (tabWindow && IsWindowVisible(tabWindow)) {
+                return true;
             }
         }
+        if (GetTickCount() - start >= kTabVisibleTimeoutMs) {
+            return false;
+        }
+        Sleep(10);
+    }
+}
 
-        if (candidateBrowser && currentCount > baselineCount) {
-            HRESULT navHr = NavigateBrowser(candidateBrowser, url);
+struct ReuseStats {
+    DWORD lookups = 0;
+    DWORD hits = 0;
+};
 
-            for (auto& t : tabs) {
-                if (t.browser && t.browser != candidateBrowser) {
-                    t.browser->Release();
+// Adds this run's lookups to the per-user totals under HKCU and prints the hit rate. The totals
+// are read and written back under the new tab lock, so processes finishing at the same time do not
+// overwrite each other's counts; if the lock cannot be had, this run's counts are dropped instead.
+static void ReportReuseStats(const ReuseStats& run) {
+    static const char* kStatsKey = "Software\\ExplorerTabMerger\\OpenFolderTab";
+    ReuseStats total = run;
+    bool updated = false;
+
+    NewTabLock lock;
+    if (!lock.Acquire(kNewTabLockWaitMs)) {
+        std::cerr << "[warn] Timed out waiting for another process to finish opening a tab; reuse totals not updated."
+                  << std::endl;
+    } else {
+        HKEY key = nullptr;
+        if (RegCreateKeyExA(HKEY_CURRENT_USER, kStatsKey, 0, nullptr, REG_OPTION_NON_VOLATILE,
+                            KEY_QUERY_VALUE | KEY_SET_VALUE, nullptr, &key, nullptr) == ERROR_SUCCESS) {
+            auto readValue = [key](const char* name) -> DWORD {
+                DWORD value = 0, size = sizeof(value), type = 0;
+                if (RegQueryValueExA(key, name, nullptr, &type, (BYTE*)&value, &size) != ERROR_SUCCESS || type != REG_DWORD) {
+                    return 0;
                 }
+                return value;
+            };
+            total.lookups += readValue("ReuseLookups");
+            total.hits += readValue("ReuseHits");
+            LONG written = RegSetValueExA(key, "ReuseLookups", 0, REG_DWORD, (const BYTE*)&total.lookups, sizeof(DWORD));
+            if (written == ERROR_SUCCESS) {
+                written = RegSetValueExA(key, "ReuseHits", 0, REG_DWORD, (const BYTE*)&total.hits, sizeof(DWORD));
             }
+            updated = written == ERROR_SUCCESS;
+            RegCloseKey(key);
+        }
+        lock.Release();
+    }
 
-            if (SUCCEEDED(navHr)) {
-                success = true;
-            }
-
-            candidateBrowser->Release();
-            break;
+    std::cout << "[stats] Existing tab reused for " << run.hits << " of " << run.lookups << " folder(s)";
+    if (updated) {
+        std::cout << "; overall hit rate " << total.hits << "/" << total.lookups;
+        if (total.lookups) {
+            std::cout << " (" << (total.hits * 100 / total.lookups) << "%)";
         }
+    }
+    std::cout << std::endl;
+}
+
+// The first window's tabs, as RequestAndClaimNewTab sees them (see new_tab_lock.h). Every tab
+// enumerated is held until the shell is destroyed, so browser pointers stay unique tab ids.
+class FirstWindowShell {
+public:
+    explicit FirstWindowShell(HWND window, HWND tabHost) : window_(window), tabHost_(tabHost) {}
 
+    bool FirstWindowTabs(std::vector<uintptr_t>& ids) {
+        std::vector<TabInfo> tabs;
+        std::vector<HWND> windows;
+        if (!CollectExplorerTabs(tabs, windows, window_, false)) {
+            return false;
+        }
         for (auto& t : tabs) {
-            if (t.browser) {
-                t.browser->Release();
+            ids.push_back(reinterpret_cast<uintptr_t>(t.browser.Get()));
+            held_.push_back(std::move(t));
+        }
+        return true;
+    }
+
+    void RequestNewTab() { SendMessageA(tabHost_, WM_COMMAND, (WPARAM)WM_COMMAND_ID_NEW_TAB, 0); }
+    void Wait(uint32_t ms) { Sleep(ms); }
+
+    IWebBrowser2* Browser(uintptr_t id) const {
+        for (const auto& t : held_) {
+            if (reinterpret_cast<uintptr_t>(t.browser.Get()) == id) return t.browser.Get();
+        }
+        return nullptr;
+    }
+
+private:
+    HWND window_;
+    HWND tabHost_;
+    std::vector<TabInfo> held_;
+};
+
+static const uint32_t kNewTabTimeoutMs = 8000;
+static const uint32_t kNewTabRetryMs = 300;
+
+// WindowShown: the folder is already open, but its tab could not be selected; its window was
+// brought to the front instead of creating a duplicate tab.
+enum class TabOpenResult { Failed, Created, Reused, WindowShown };
+
+// Opens url in the first window. With allowReuse the single baseline enumeration covers every
+// window and also builds the location index; a tab already showing the folder is activated
+// instead of creating a new one. A newly created tab is returned in createdTab.
+static TabOpenResult OpenFolderInTab(HWND firstWindow, HWND tabHost, const std::string& url, bool allowReuse,
+                                     ReuseStats& stats, ComPtr<IWebBrowser2>& createdTab) {
+    if (!firstWindow || !tabHost || url.empty()) return TabOpenResult::Failed;
+
+    NewTabLock lock;
+    if (!lock.Acquire(kNewTabLockWaitMs)) {
+        std::cerr << "Timed out waiting for another process to finish opening a tab." << std::endl;
+        return TabOpenResult::Failed;
+    }
+
+    std::vector<TabInfo> baselineTabs;
+    std::vector<HWND> beforeWindows;
+    if (!CollectExplorerTabs(baselineTabs, beforeWindows, allowReuse ? nullptr : firstWindow, allowReuse)) {
+        return TabOpenResult::Failed;
+    }
+
+    if (allowReuse) {
+        std::map<std::string, size_t> locationIndex;
+        for (size_t i = 0; i < baselineTabs.size(); ++i) {
+            if (!baselineTabs[i].url.empty()) {
+                locationIndex.emplace(LocationKeyFromUrl(baselineTabs[i].url), i);
             }
         }
 
-        Sleep(retryMs);
-        waited += retryMs;
+        ++stats.lookups;
+        auto hit = locationIndex.find(LocationKeyFromPath(url));
+        if (hit != locationIndex.end()) {
+            ++stats.hits;
+            if (ActivateTab(baselineTabs[hit->second])) {
+                return TabOpenResult::Reused;
+            }
+            std::cerr << "The folder is already open, but its tab could not be selected; select it in the "
+                         "window brought to the front." << std::endl;
+            return TabOpenResult::WindowShown;
+        }
     }
 
+    NewTabClaims claims;
     for (auto& t : baselineTabs) {
-        if (t.browser) {
-            t.browser->Release();
+        if (t.topLevel == firstWindow) {
+            claims.AddKnown({ reinterpret_cast<uintptr_t>(t.browser.Get()) });
         }
     }
 
-    return success;
+    FirstWindowShell shell(firstWindow, tabHost);
+    uintptr_t tab = RequestAndClaimNewTab(shell, claims, kNewTabTimeoutMs, kNewTabRetryMs);
+    if (!tab || FAILED(NavigateBrowser(shell.Browser(tab), url))) {
+        return TabOpenResult::Failed;
+    }
+    createdTab.Assign(shell.Browser(tab));
+
+    // The baseline tabs are held until here so their browser pointers stay valid identities.
+    return TabOpenResult::Created;
 }
 
-static std::string NormalizeFolderPath(const std::string& input) {
-    if (input.empty()) {
-        return std::string();
+// --- Path resolution (see folder_paths.h) ---
+// Every requested folder is resolved before any UI work, on a small private thread pool.
+static const DWORD kPathProbeTimeoutMs = 3000;
+static const DWORD kMaxPathProbeThreads = 8;
+
+static VOID CALLBACK PathProbeCallback(PTP_CALLBACK_INSTANCE, PVOID context) {
+    std::unique_ptr<std::function<void()>> task(static_cast<std::function<void()>*>(context));
+    (*task)();
+}
+
+static std::vector<ResolvedPath> ResolveFolderPaths(const std::vector<std::string>& inputs) {
+    PTP_POOL pool = CreateThreadpool(nullptr);
+    TP_CALLBACK_ENVIRON environment;
+    InitializeThreadpoolEnvironment(&environment);
+    if (pool) {
+        SetThreadpoolThreadMaximum(pool, kMaxPathProbeThreads);
+        SetThreadpoolThreadMinimum(pool, 1);
+        SetThreadpoolCallbackPool(&environment, pool);
     }
 
-    DWORD required = GetFullPathNameA(input.c_str(), 0, nullptr, nullptr);
-    if (required == 0) {
-        return input;
+    FolderPathResolver resolver(
+        [&environment](std::function<void()> task) {
+            auto* context = new std::function<void()>(std::move(task));
+            if (!TrySubmitThreadpoolCallback(PathProbeCallback, context, &environment)) {
+                delete context;
+                return false;
+            }
+            return true;
+        },
+        std::chrono::milliseconds(kPathProbeTimeoutMs));
+    std::vector<ResolvedPath> resolved = resolver.Resolve(inputs);
+
+    DestroyThreadpoolEnvironment(&environment);
+    if (pool) {
+        CloseThreadpool(pool); // released once the late probes have finished
     }
+    return resolved;
+}
 
-    std::string fullPath(required, '\0');
-    DWORD written = GetFullPathNameA(input.c_str(), required, &fullPath[0], nullptr);
-    if (written == 0 || written >= required) {
-        return input;
+static const char* DescribePathStatus(PathStatus status) {
+    switch (status) {
+    case PathStatus::Ok: return "ok";
+    case PathStatus::Empty: return "empty folder path";
+    case PathStatus::NotFound: return "folder does not exist";
+    case PathStatus::NotDirectory: return "not a folder";
+    case PathStatus::Unreachable: return "location is not reachable";
+    case PathStatus::TimedOut: return "timed out while checking the location";
     }
+    return "unknown error";
+}
+
+static bool LaunchFolder(const std::string& path) {
+    HINSTANCE se = ShellExecuteA(nullptr, "open", path.c_str(), nullptr, nullptr, SW_SHOWNORMAL);
+    return (INT_PTR)se > 32;
+}
 
-    fullPath.resize(written);
-    return fullPath;
+// Milliseconds since this process was created, so startup cost before main() is included.
+static double MsSinceProcessStart() {
+    FILETIME creation, exitTime, kernel, user, now;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exitTime, &kernel, &user)) {
+        return 0.0;
+    }
+    GetSystemTimeAsFileTime(&now);
+    auto ticks = [](const FILETIME& ft) {
+        return ((unsigned long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    };
+    return (double)(ticks(now) - ticks(creation)) / 10000.0;
 }
 
+// Times after main() entry come from the steady clock, which is finer than the process times;
+// they are offset by the startup time measured once at entry.
+class StartupTimer {
+public:
+    StartupTimer() : entry_(std::chrono::steady_clock::now()), startupMs_(MsSinceProcessStart()) {}
+
+    double StartupMs() const { return startupMs_; }
+    double SinceEntryMs() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - entry_).count();
+    }
+    double SinceProcessStartMs() const { return startupMs_ + SinceEntryMs(); }
+
+private:
+    std::chrono::steady_clock::time_point entry_;
+    double startupMs_;
+};
+
+static const double kStartupTargetMs = 100.0;
+
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: open_folder_tab.exe <folder path>" << std::endl;
-        return 1;
+    // Process creation until here is loader and runtime startup, not any work of ours.
+    StartupTimer timer;
+    bool reportTiming = false;
+    bool allowReuse = true;
+    int firstPath = 1;
+    for (; firstPath < argc; ++firstPath) {
+        std::string arg = argv[firstPath];
+        if (arg == "--timing") {
+            reportTiming = true;
+        } else if (arg == "--new-tab") {
+            allowReuse = false;
+        } else {
+            break;
+        }
     }
 
-    std::string targetPath = NormalizeFolderPath(argv[1]);
-    if (targetPath.empty()) {
-        std::cerr << "Empty folder path provided." << std::endl;
+    if (firstPath >= argc) {
+        std::cerr << "Usage: open_folder_tab.exe [--timing] [--new-tab] <folder path> [<folder path> ...]" << std::endl;
         return 1;
     }
 
-    HRESULT hr = CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED);
-    if (FAILED(hr)) {
-        std::cerr << "CoInitializeEx failed: 0x" << std::hex << hr << std::endl;
+    std::vector<std::string> targetPaths;
+    for (const auto& r : ResolveFolderPaths(std::vector<std::string>(argv + firstPath, argv + argc))) {
+        if (r.status == PathStatus::Ok) {
+            targetPaths.push_back(r.path);
+        } else {
+            std::cerr << "Skipping \"" << r.path << "\": " << DescribePathStatus(r.status);
+            if (r.error) std::cerr << " (error " << r.error << ")";
+            std::cerr << std::endl;
+        }
+    }
+    if (targetPaths.empty()) {
+        std::cerr << "No usable folder path provided." << std::endl;
         return 1;
     }
+    double resolvedMs = timer.SinceEntryMs();
 
-    std::vector<TabInfo> tabs;
-    std::vector<HWND> windowOrder;
-    bool hasTabs = CollectExplorerTabs(tabs, windowOrder);
-
-    for (auto& t : tabs) {
-        if (t.browser) t.browser->Release();
+    ComApartment apartment;
+    if (FAILED(apartment.Result())) {
+        std::cerr << "CoInitializeEx failed: 0x" << std::hex << apartment.Result() << std::endl;
+        return 1;
     }
 
-    if (!hasTabs || windowOrder.empty()) {
+    HWND firstWindow = nullptr;
+    HWND tabHost = nullptr;
+    if (!FindFirstExplorerWindow(firstWindow, tabHost)) {
         std::cout << "No Explorer window found; launching folder via ShellExecute." << std::endl;
-        HINSTANCE se = ShellExecuteA(nullptr, "open", targetPath.c_str(), nullptr, nullptr, SW_SHOWNORMAL);
-        CoUninitialize();
-        return (INT_PTR)se <= 32 ? 2 : 0;
+        bool launched = true;
+        for (const auto& path : targetPaths) {
+            launched = LaunchFolder(path) && launched;
+        }
+        return launched ? 0 : 2;
     }
-
-    HWND firstWindow = windowOrder.front();
-    HWND tabHost = FindShellTabHost(firstWindow);
-    if (!tabHost) {
-        std::cerr << "Could not find ShellTabWindowClass in the first window." << std::endl;
-        CoUninitialize();
-        return 3;
+    double discoveredMs = timer.SinceEntryMs();
+
+    ReuseStats reuseStats;
+    for (const auto& path : targetPaths) {
+        ComPtr<IWebBrowser2> createdTab;
+        TabOpenResult result = OpenFolderInTab(firstWindow, tabHost, path, allowReuse, reuseStats, createdTab);
+        if (result == TabOpenResult::Failed) {
+            std::cerr << "Failed to create or navigate new tab; falling back to ShellExecute." << std::endl;
+            LaunchFolder(path);
+        }
+        if (reportTiming) {
+            // Navigate2 returns before the tab shows anything, so a new tab is timed once it
+            // shows the folder and is selected; an activated tab is already visible.
+            bool visible = result == TabOpenResult::Reused ||
+                           (result == TabOpenResult::Created && WaitUntilTabVisible(createdTab.Get(), path));
+            double visibleMs = timer.SinceProcessStartMs();
+            std::cout << "[timing] " << path << ": "
+                      << (visible ? "tab visible " : result == TabOpenResult::Failed ? "ShellExecute returned "
+                                                                                      : "tab still not visible ")
+                      << (long)visibleMs << " ms after process start"
+                      << " (startup " << (long)timer.StartupMs() << " ms, paths " << (long)resolvedMs
+                      << " ms, window " << (long)(discoveredMs - resolvedMs)
+                      << " ms, target " << (long)kStartupTargetMs << " ms"
+                      << (!visible || visibleMs > kStartupTargetMs ? ", over target" : "") << ")" << std::endl;
+        }
     }
 
-    if (!CreateTabAndNavigate(firstWindow, tabHost, targetPath)) {
-        std::cerr << "Failed to create or navigate new tab; falling back to ShellExecute." << std::endl;
-        ShellExecuteA(nullptr, "open", targetPath.c_str(), nullptr, nullptr, SW_SHOWNORMAL);
+    if (allowReuse) {
+        ReportReuseStats(reuseStats);
     }
 
-    CoUninitialize();
     return 0;
 }
-
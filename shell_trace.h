@@ -0,0 +1,357 @@
+// shell_trace.h - Shell interaction trace of merge_tabs: format, replay clock and traced shell (platform-neutral, C++20)
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tab_engine.h"
+
+// --- Shell interaction trace (record / replay) ---
+// Every call into the shell goes through the trace. With --record each call is appended to a
+// trace file together with its start offset, duration and result; with --replay the recorded
+// results are served instead of touching Explorer, and each call blocks for as long as it did
+// when recorded. Offsets are measured from the point the merge slot is held, so time spent queued
+// for a slot is not part of the trace.
+//
+// Trace file format (tab separated, one event per line):
+//   collect <startMs> <durationMs> <ok> <tabCount>   followed by <tabCount> lines:
+//   tab <id> <topLevel> <url>
+//   call <kind> <startMs> <durationMs> <target> <result> <detail>
+// where kind is "tabhost" (target = top-level HWND, result = tab host HWND, no detail), "send"
+// (target = HWND, result = LRESULT, detail = "<msg> <wParam>"), "newtab" (target = tab host HWND
+// the new tab command was sent to, result = 0, no detail), "navigate" (target = tab id, result =
+// HRESULT, detail = URL), "navdone" (target = tab id, result = 0 when the navigation completed,
+// otherwise its error code or 1 when unknown, duration = time from Navigate2 until completion or
+// failure, detail = URL) or "quit" (target = tab id of a tab closed after its navigation failed,
+// result = HRESULT, detail = URL). A call without detail still has its (empty) last field.
+enum class TraceMode { Off, Record, Replay };
+
+struct TraceSnapshot {
+    double startMs;
+    double durationMs;
+    bool ok;
+    std::vector<ShellTab> tabs;
+};
+
+struct TraceCall {
+    std::string kind;
+    double startMs;
+    double durationMs;
+    uintptr_t target;
+    long long result;
+    std::string detail;
+    bool consumed;
+};
+
+// Splits a trace line at tabs. Unlike reading fields with getline, an empty last field is kept.
+inline std::vector<std::string> SplitTraceLine(const std::string& line) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    for (;;) {
+        size_t tab = line.find('\t', start);
+        fields.push_back(line.substr(start, tab == std::string::npos ? std::string::npos : tab - start));
+        if (tab == std::string::npos) return fields;
+        start = tab + 1;
+    }
+}
+
+// Time base of a trace: the steady clock when merge_tabs records or replays, a virtual clock in
+// the tests.
+class TraceClock {
+public:
+    virtual ~TraceClock() = default;
+    virtual double NowMs() = 0;
+    virtual void WaitUntil(double ms) = 0;
+};
+
+class SteadyTraceClock : public TraceClock {
+public:
+    void Start() { origin_ = std::chrono::steady_clock::now(); }
+
+    double NowMs() override {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - origin_).count();
+    }
+
+    void WaitUntil(double ms) override {
+        double remaining = ms - NowMs();
+        if (remaining > 0) {
+            std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(remaining));
+        }
+    }
+
+private:
+    std::chrono::steady_clock::time_point origin_ = std::chrono::steady_clock::now();
+};
+
+class ShellTrace {
+public:
+    explicit ShellTrace(TraceClock& clock) : clock_(clock) {}
+
+    TraceMode Mode() const { return mode_; }
+    double NowMs() { return clock_.NowMs(); }
+    void WaitUntil(double ms) { clock_.WaitUntil(ms); }
+
+    bool OpenForRecord(const std::string& path) {
+        file_.open(path, std::ios::out | std::ios::trunc);
+        if (!file_) {
+            return false;
+        }
+        RecordTo(file_);
+        return true;
+    }
+
+    void RecordTo(std::ostream& out) {
+        out_ = &out;
+        *out_ << std::fixed << std::setprecision(3);
+        mode_ = TraceMode::Record;
+    }
+
+    void RecordCollect(double startMs, bool ok, const std::vector<ShellTab>& tabs) {
+        *out_ << "collect\t" << startMs << '\t' << (NowMs() - startMs) << '\t' << (ok ? 1 : 0) << '\t' << tabs.size() << "\n";
+        for (const auto& t : tabs) {
+            *out_ << "tab\t" << t.id << '\t' << t.window << '\t' << t.url << "\n";
+        }
+        out_->flush();
+    }
+
+    void RecordCall(const char* kind, double startMs, uintptr_t target, long long result, const std::string& detail) {
+        *out_ << "call\t" << kind << '\t' << startMs << '\t' << (NowMs() - startMs) << '\t' << target << '\t' << result
+              << '\t' << detail << std::endl;
+    }
+
+    bool LoadForReplay(const std::string& path) {
+        std::ifstream in(path);
+        if (!in) {
+            return false;
+        }
+        Load(in, std::cerr);
+        std::cout << "[replay] Loaded " << snapshots_.size() << " snapshot(s) and " << calls_.size() << " call(s) from "
+                  << path << "\n";
+        return true;
+    }
+
+    // Reads a trace; malformed lines are reported on warnings and skipped.
+    void Load(std::istream& in, std::ostream& warnings) {
+        std::string line;
+        size_t pendingTabs = 0;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+
+            std::vector<std::string> fields = SplitTraceLine(line);
+            try {
+                if (fields[0] == "collect" && fields.size() >= 5) {
+                    snapshots_.push_back({ std::stod(fields[1]), std::stod(fields[2]), fields[3] == "1", {} });
+                    pendingTabs = (size_t)std::stoull(fields[4]);
+                } else if (fields[0] == "tab" && fields.size() >= 3 && pendingTabs > 0 && !snapshots_.empty()) {
+                    snapshots_.back().tabs.push_back({ (uintptr_t)std::stoull(fields[1]), (uintptr_t)std::stoull(fields[2]),
+                                                      fields.size() >= 4 ? fields[3] : std::string() });
+                    --pendingTabs;
+                } else if (fields[0] == "call" && fields.size() >= 7) {
+                    calls_.push_back({ fields[1], std::stod(fields[2]), std::stod(fields[3]), (uintptr_t)std::stoull(fields[4]),
+                                       std::stoll(fields[5]), fields[6], false });
+                } else {
+                    warnings << "[warn] Ignoring malformed trace line: " << line << "\n";
+                }
+            } catch (const std::exception&) {
+                warnings << "[warn] Ignoring malformed trace line: " << line << "\n";
+            }
+        }
+        mode_ = TraceMode::Replay;
+    }
+
+    const std::vector<TraceSnapshot>& Snapshots() const { return snapshots_; }
+    const std::vector<TraceCall>& Calls() const { return calls_; }
+
+    size_t UnconsumedCalls() const {
+        size_t count = 0;
+        for (const auto& c : calls_) count += c.consumed ? 0 : 1;
+        return count;
+    }
+
+    // Serves the snapshot the shell would have returned at the current point of the replay clock,
+    // so the moment a new tab shows up relative to the new tab command is reproduced as recorded.
+    // Returns null when the trace has no snapshots.
+    const TraceSnapshot* ReplayCollect() {
+        if (snapshots_.empty()) {
+            return nullptr;
+        }
+        double now = NowMs();
+        const TraceSnapshot* snapshot = &snapshots_.front();
+        for (const auto& s : snapshots_) {
+            if (s.startMs > now) break;
+            snapshot = &s;
+        }
+        WaitUntil(now + snapshot->durationMs);
+        return snapshot;
+    }
+
+    // Serves the result of the next recorded call of this kind after waiting as long as it took.
+    bool ReplayCall(const char* kind, uintptr_t target, long long& result) {
+        double now = NowMs();
+        const TraceCall* call = NextCall(kind, target);
+        if (!call) return false;
+        WaitUntil(now + call->durationMs);
+        result = call->result;
+        return true;
+    }
+
+    // Returns the next unconsumed recorded call of the given kind; matching on target is preferred
+    // so a replayed run that reorders its calls still receives the right results.
+    const TraceCall* NextCall(const char* kind, uintptr_t target) {
+        TraceCall* fallback = nullptr;
+        for (auto& c : calls_) {
+            if (c.consumed || c.kind != kind) continue;
+            if (c.target == target) {
+                c.consumed = true;
+                return &c;
+            }
+            if (!fallback) fallback = &c;
+        }
+        if (fallback) {
+            fallback->consumed = true;
+        } else {
+            std::cerr << "[replay] Trace has no more '" << kind << "' calls.\n";
+        }
+        return fallback;
+    }
+
+private:
+    TraceClock& clock_;
+    TraceMode mode_ = TraceMode::Off;
+    std::ofstream file_;
+    std::ostream* out_ = nullptr;
+    std::vector<TraceSnapshot> snapshots_;
+    std::vector<TraceCall> calls_;
+};
+
+// --- Traced tab shell ---
+// Puts the trace between the tab engine and the shell. Recording, every call is forwarded to the
+// inner shell and recorded; replaying, every call is served from the trace and the inner shell is
+// only asked whether the user canceled (it may be null). A replayed merge creates no tabs, so it
+// does not take the new tab lock.
+class TracedTabShell : public TabShell {
+public:
+    TracedTabShell(ShellTrace& trace, TabShell* inner, uintptr_t tabHost) : trace_(trace), inner_(inner), tabHost_(tabHost) {}
+
+    bool EnumerateTabs(std::vector<ShellTab>& tabs) override {
+        if (Replaying()) {
+            const TraceSnapshot* snapshot = trace_.ReplayCollect();
+            if (!snapshot) return false;
+            tabs.insert(tabs.end(), snapshot->tabs.begin(), snapshot->tabs.end());
+            return snapshot->ok;
+        }
+        double startMs = trace_.NowMs();
+        std::vector<ShellTab> found;
+        bool ok = inner_->EnumerateTabs(found);
+        if (Recording()) trace_.RecordCollect(startMs, ok, found);
+        tabs.insert(tabs.end(), found.begin(), found.end());
+        return ok;
+    }
+
+    void RequestNewTab() override {
+        if (Replaying()) {
+            long long result = 0;
+            trace_.ReplayCall("newtab", tabHost_, result);
+            return;
+        }
+        double startMs = trace_.NowMs();
+        inner_->RequestNewTab();
+        if (Recording()) trace_.RecordCall("newtab", startMs, tabHost_, 0, std::string());
+    }
+
+    long Navigate(uintptr_t tab, const std::string& url) override {
+        double startMs = trace_.NowMs();
+        navigations_[tab] = { startMs, url };
+        if (Replaying()) {
+            long long result = -1;
+            trace_.ReplayCall("navigate", tab, result);
+            if (result >= 0) {
+                // How the navigation ended, and when, as recorded.
+                const TraceCall* done = trace_.NextCall("navdone", tab);
+                replayed_[tab] = { startMs + (done ? done->durationMs : 0.0), !done || done->result == 0,
+                                   done ? (long)done->result : 0L };
+            }
+            return (long)result;
+        }
+        long hr = inner_->Navigate(tab, url);
+        if (Recording()) trace_.RecordCall("navigate", startMs, tab, hr, url);
+        return hr;
+    }
+
+    NavigationPoll PollNavigation(uintptr_t tab, bool deadline) override {
+        if (Replaying()) {
+            auto it = replayed_.find(tab);
+            if (it == replayed_.end()) return { NavigationStatus::Failed, 0 };
+            if (!deadline && trace_.NowMs() < it->second.doneAt) return { NavigationStatus::Pending, 0 };
+            NavigationPoll poll = { it->second.complete ? NavigationStatus::Complete : NavigationStatus::Failed,
+                                    it->second.complete || it->second.error == 1 ? 0L : it->second.error };
+            replayed_.erase(it);
+            return poll;
+        }
+        NavigationPoll poll = inner_->PollNavigation(tab, deadline);
+        if (Recording() && poll.status != NavigationStatus::Pending) {
+            const Navigation& n = navigations_[tab];
+            long long result = poll.status == NavigationStatus::Complete ? 0 : poll.error ? poll.error : 1;
+            trace_.RecordCall("navdone", n.startMs, tab, result, n.url);
+        }
+        return poll;
+    }
+
+    long QuitTab(uintptr_t tab) override {
+        if (Replaying()) {
+            long long result = -1;
+            trace_.ReplayCall("quit", tab, result);
+            return (long)result;
+        }
+        double startMs = trace_.NowMs();
+        long hr = inner_->QuitTab(tab);
+        if (Recording()) trace_.RecordCall("quit", startMs, tab, hr, navigations_[tab].url);
+        return hr;
+    }
+
+    bool TryLockNewTabs() override { return Replaying() || inner_->TryLockNewTabs(); }
+    void UnlockNewTabs() override {
+        if (!Replaying()) inner_->UnlockNewTabs();
+    }
+
+    double NowMs() override { return trace_.NowMs(); }
+
+    void WaitForEvents(double ms) override {
+        if (Replaying()) {
+            trace_.WaitUntil(trace_.NowMs() + ms);
+        } else {
+            inner_->WaitForEvents(ms);
+        }
+    }
+
+    bool CancelRequested() override { return inner_ && inner_->CancelRequested(); }
+
+private:
+    struct Navigation {
+        double startMs = 0.0;
+        std::string url;
+    };
+    struct ReplayedNavigation {
+        double doneAt;
+        bool complete;
+        long error;
+    };
+
+    bool Recording() const { return trace_.Mode() == TraceMode::Record; }
+    bool Replaying() const { return trace_.Mode() == TraceMode::Replay; }
+
+    ShellTrace& trace_;
+    TabShell* inner_;
+    uintptr_t tabHost_;
+    std::map<uintptr_t, Navigation> navigations_;
+    std::map<uintptr_t, ReplayedNavigation> replayed_;
+};
@@ -0,0 +1,465 @@
+// tab_engine.h - Tab operation engine of merge_tabs on a coroutine executor (platform-neutral, C++20)
+#pragma once
+
+#include <algorithm>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "new_tab_lock.h"
+
+// --- Shell interface ---
+// Everything the engine needs from Explorer. merge_tabs implements it with COM and window
+// messages (and with a recorded trace when replaying); the tests implement it with a simulated
+// shell on a virtual clock.
+struct ShellTab {
+    uintptr_t id;     // stable identity of the tab
+    uintptr_t window; // top-level window the tab belongs to
+    std::string url;
+};
+
+enum class NavigationStatus { Pending, Complete, Failed };
+
+struct NavigationPoll {
+    NavigationStatus status;
+    long error; // status code of a failed navigation, 0 when unknown
+};
+
+class TabShell {
+public:
+    virtual ~TabShell() = default;
+
+    virtual bool EnumerateTabs(std::vector<ShellTab>& tabs) = 0;
+    virtual void RequestNewTab() = 0;
+    // Starts navigating a tab returned by EnumerateTabs and returns the HRESULT of the request.
+    virtual long Navigate(uintptr_t tab, const std::string& url) = 0;
+    // Reports on the navigation Navigate started. At the deadline the shell checks the tab one last
+    // time and answers Complete or Failed, never Pending.
+    virtual NavigationPoll PollNavigation(uintptr_t tab, bool deadline) = 0;
+    virtual long QuitTab(uintptr_t tab) = 0;
+
+    // The cross-process new tab lock (see new_tab_lock.h); TryLockNewTabs does not block.
+    virtual bool TryLockNewTabs() = 0;
+    virtual void UnlockNewTabs() = 0;
+
+    // The engine only ever waits in WaitForEvents, which pumps the STA message loop on Windows.
+    virtual double NowMs() = 0;
+    virtual void WaitForEvents(double ms) = 0;
+    virtual bool CancelRequested() = 0;
+};
+
+// --- Tab operations ---
+enum class TabOpState { Pending, WaitingForTab, Navigating, Navigated, Failed, Canceled };
+
+struct TabOperation {
+    std::string url;
+    uintptr_t donor = 0;
+    size_t journalIndex = 0;
+    TabOpState state = TabOpState::Pending;
+    uintptr_t tab = 0;
+    double requestedAt = 0.0;
+    double navigateStartedAt = 0.0;
+    double completedAt = 0.0;
+};
+
+// Told about every step that must survive an interruption (merge_tabs journals them).
+class TabProgress {
+public:
+    virtual ~TabProgress() = default;
+    virtual void Created(const TabOperation&) {}
+    virtual void Navigated(const TabOperation&) {}
+};
+
+struct TabEngineLimits {
+    size_t maxTabsInFlight = 4;
+    double tabDeadlineMs = 8000;
+    double navigateDeadlineMs = 15000;
+    double tabPollMs = 300;
+    double navigatePollMs = 50;
+    double lockWaitMs = 60000;
+};
+
+// --- Single-threaded coroutine executor ---
+// A TabTask starts suspended and is resumed only by the executor. Suspended tasks wait for a timer
+// or for another task to wake them; when nothing is ready, the executor waits in the shell until
+// the next timer is due, so no task ever blocks the thread.
+class TabTask {
+public:
+    struct promise_type {
+        TabTask get_return_object() { return TabTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    explicit TabTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+    TabTask(TabTask&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    TabTask(const TabTask&) = delete;
+    TabTask& operator=(const TabTask&) = delete;
+    TabTask& operator=(TabTask&&) = delete;
+    ~TabTask() {
+        if (handle_) handle_.destroy();
+    }
+
+    std::coroutine_handle<> Handle() const { return handle_; }
+    bool Done() const { return !handle_ || handle_.done(); }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+class TabExecutor {
+public:
+    explicit TabExecutor(TabShell& shell) : shell_(shell) {}
+
+    void Spawn(TabTask task) {
+        Post(task.Handle());
+        tasks_.push_back(std::move(task));
+    }
+
+    void Post(std::coroutine_handle<> handle) { ready_.push_back(handle); }
+
+    void At(double ms, std::function<void()> fire) { timers_.emplace(ms, std::move(fire)); }
+
+    // co_await Sleep(ms) resumes the task once ms have passed.
+    auto Sleep(double ms) {
+        struct Awaiter {
+            TabExecutor& executor;
+            double until;
+            bool await_ready() const { return false; }
+            void await_suspend(std::coroutine_handle<> handle) {
+                TabExecutor& e = executor;
+                e.At(until, [&e, handle] { e.Post(handle); });
+            }
+            void await_resume() const {}
+        };
+        return Awaiter{ *this, shell_.NowMs() + ms };
+    }
+
+    // Runs until every task has finished (or no timer is left that could wake the rest).
+    void Run() {
+        for (;;) {
+            while (!ready_.empty()) {
+                std::coroutine_handle<> handle = ready_.front();
+                ready_.pop_front();
+                handle.resume();
+            }
+            if (std::all_of(tasks_.begin(), tasks_.end(), [](const TabTask& t) { return t.Done(); }) || timers_.empty()) {
+                return;
+            }
+            double now = shell_.NowMs();
+            auto first = timers_.begin();
+            if (first->first > now) {
+                shell_.WaitForEvents(first->first - now);
+                continue;
+            }
+            std::function<void()> fire = std::move(first->second);
+            timers_.erase(first);
+            fire();
+        }
+    }
+
+private:
+    TabShell& shell_;
+    std::vector<TabTask> tasks_;
+    std::deque<std::coroutine_handle<>> ready_;
+    std::multimap<double, std::function<void()>> timers_;
+};
+
+// Tasks waiting for another task to wake them, in the order they started waiting.
+class TabWaitQueue {
+public:
+    explicit TabWaitQueue(TabExecutor& executor) : executor_(executor) {}
+
+    auto Wait() {
+        struct Awaiter {
+            TabWaitQueue& queue;
+            bool await_ready() const { return false; }
+            void await_suspend(std::coroutine_handle<> handle) { queue.waiters_.push_back(handle); }
+            void await_resume() const {}
+        };
+        return Awaiter{ *this };
+    }
+
+    void NotifyOne() {
+        if (!waiters_.empty()) {
+            executor_.Post(waiters_.front());
+            waiters_.pop_front();
+        }
+    }
+
+    void NotifyAll() {
+        while (!waiters_.empty()) NotifyOne();
+    }
+
+private:
+    TabExecutor& executor_;
+    std::deque<std::coroutine_handle<>> waiters_;
+};
+
+// --- Tab operation engine ---
+// Every tab move of a merge is a coroutine: request a new tab, wait for it, navigate it and wait
+// for the navigation to be confirmed, each step with its own deadline. Up to maxTabsInFlight
+// operations run at once on the one thread, in the order given. A dispatcher coroutine enumerates
+// the tabs once per polling round while any operation waits for its tab, and hands every tab of
+// the first window that was not there before to the oldest waiting operation. A tab that shows up
+// after its operation gave up is closed instead of being left behind.
+//
+// New tab requests are only sent while holding the new tab lock, and the lock is released as soon
+// as every request sent has its tab (or was given up on). Each time it is taken again, the first
+// window's tabs are enumerated so tabs other processes opened in between are never claimed.
+// Cancellation stops operations that have not sent their request; the others run to completion.
+class TabEngine {
+public:
+    TabEngine(TabShell& shell, uintptr_t firstWindow, TabProgress& progress, TabEngineLimits limits = TabEngineLimits())
+        : shell_(shell), firstWindow_(firstWindow), progress_(progress), limits_(limits), executor_(shell),
+          slotFreed_(executor_), claimRegistered_(executor_) {}
+
+    // Runs every operation to completion and returns the number of navigated tabs.
+    size_t Run(std::vector<TabOperation>& ops) {
+        unfinished_ = ops.size();
+        executor_.Spawn(DispatchNewTabs());
+        for (auto& op : ops) {
+            executor_.Spawn(Operate(op));
+        }
+        executor_.Run();
+        if (lockHeld_) {
+            shell_.UnlockNewTabs();
+            lockHeld_ = false;
+        }
+        return successCount_;
+    }
+
+private:
+    struct TabClaim {
+        std::coroutine_handle<> waiter;
+        bool done = false;
+        uintptr_t tab = 0;
+    };
+
+    // co_await ClaimAwaiter resumes once the dispatcher has handed the operation a tab, or at the
+    // deadline with none.
+    struct ClaimAwaiter {
+        TabEngine& engine;
+        const std::shared_ptr<TabClaim>& claim; // owned by the operation's frame
+        double deadline;
+        bool await_ready() const { return claim->done; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            claim->waiter = handle;
+            TabEngine& e = engine;
+            std::shared_ptr<TabClaim> c = claim;
+            e.executor_.At(deadline, [&e, c] {
+                if (!c->done) {
+                    c->done = true;
+                    e.waiting_.erase(std::find(e.waiting_.begin(), e.waiting_.end(), c));
+                    e.executor_.Post(c->waiter);
+                }
+            });
+        }
+        void await_resume() const {}
+    };
+
+    std::vector<uintptr_t> FirstWindowTabIds(const std::vector<ShellTab>& tabs) const {
+        std::vector<uintptr_t> ids;
+        for (const auto& t : tabs) {
+            if (t.window == firstWindow_) ids.push_back(t.id);
+        }
+        return ids;
+    }
+
+    // Takes the lock if it is free and records the tabs that are already there.
+    bool TryTakeLock(bool& failed) {
+        failed = false;
+        if (lockHeld_) return true;
+        if (!shell_.TryLockNewTabs()) return false;
+        lockHeld_ = true;
+        std::vector<ShellTab> tabs;
+        if (!shell_.EnumerateTabs(tabs)) {
+            failed = true;
+            ReleaseLockIfIdle();
+            return false;
+        }
+        std::vector<uintptr_t> ids = FirstWindowTabIds(tabs);
+        claims_.AddKnown(ids);
+        std::cout << "[debug] Baseline tab count for first window: " << ids.size() << "\n";
+        return true;
+    }
+
+    // Every request sent so far has its tab (or was given up on): let other processes open theirs.
+    void ReleaseLockIfIdle() {
+        if (lockHeld_ && waiting_.empty() && lateTabs_.empty()) {
+            shell_.UnlockNewTabs();
+            lockHeld_ = false;
+        }
+    }
+
+    void Finish(TabOperation& op, TabOpState state, bool inFlight) {
+        op.state = state;
+        op.completedAt = shell_.NowMs();
+        if (inFlight) {
+            --inFlight_;
+            slotFreed_.NotifyOne();
+        }
+        if (--unfinished_ == 0) {
+            claimRegistered_.NotifyAll();
+        }
+    }
+
+    // A claimed tab that did not reach its location is closed; the donor tab stays open and the
+    // next run retries it.
+    void Fail(TabOperation& op) {
+        long hr = shell_.QuitTab(op.tab);
+        if (hr < 0) {
+            std::cerr << "[warn] Could not close the new tab (0x" << std::hex << hr << std::dec
+                      << ") for: " << op.url << "\n";
+        }
+        Finish(op, TabOpState::Failed, true);
+    }
+
+    TabTask Operate(TabOperation& op) {
+        while (inFlight_ >= limits_.maxTabsInFlight) {
+            co_await slotFreed_.Wait();
+        }
+        if (shell_.CancelRequested()) {
+            Finish(op, TabOpState::Canceled, false);
+            slotFreed_.NotifyOne(); // pass the free slot on, so the next operation is canceled too
+            co_return;
+        }
+        ++inFlight_;
+
+        double lockWaitStart = shell_.NowMs();
+        for (;;) {
+            bool failed = false;
+            if (TryTakeLock(failed)) break;
+            if (failed) {
+                std::cerr << "[warn] Could not enumerate the first window's tabs for: " << op.url << "\n";
+                Finish(op, TabOpState::Failed, true);
+                co_return;
+            }
+            if (shell_.CancelRequested()) {
+                Finish(op, TabOpState::Canceled, true);
+                co_return;
+            }
+            if (shell_.NowMs() - lockWaitStart > limits_.lockWaitMs) {
+                std::cerr << "[warn] Timed out waiting for another process to finish opening a tab.\n";
+                Finish(op, TabOpState::Failed, true);
+                co_return;
+            }
+            co_await executor_.Sleep(limits_.tabPollMs);
+        }
+
+        std::cout << "[debug] Requesting a new tab for: " << op.url << "\n";
+        op.requestedAt = shell_.NowMs();
+        shell_.RequestNewTab();
+        op.state = TabOpState::WaitingForTab;
+        auto claim = std::make_shared<TabClaim>();
+        waiting_.push_back(claim);
+        claimRegistered_.NotifyAll();
+        co_await ClaimAwaiter{ *this, claim, op.requestedAt + limits_.tabDeadlineMs };
+
+        if (!claim->tab) {
+            std::cerr << "[warn] Timed out waiting for a new tab for: " << op.url << "\n";
+            // The tab may still come; until then it must not be claimed for another request.
+            lateTabs_.push_back(shell_.NowMs() + limits_.tabDeadlineMs);
+            Finish(op, TabOpState::Failed, true);
+            co_return;
+        }
+        ReleaseLockIfIdle();
+
+        op.tab = claim->tab;
+        std::cout << "[debug] Identified new tab 0x" << std::hex << op.tab << std::dec << " for: " << op.url << "\n";
+        progress_.Created(op);
+        op.navigateStartedAt = shell_.NowMs();
+        long hr = shell_.Navigate(op.tab, op.url);
+        if (hr < 0) {
+            std::cerr << "[warn] Navigate2 failed (0x" << std::hex << hr << std::dec << ") for: " << op.url << "\n";
+            Fail(op);
+            co_return;
+        }
+        op.state = TabOpState::Navigating;
+
+        for (;;) {
+            bool deadline = shell_.NowMs() - op.navigateStartedAt > limits_.navigateDeadlineMs;
+            NavigationPoll poll = shell_.PollNavigation(op.tab, deadline);
+            if (poll.status == NavigationStatus::Complete) {
+                std::cout << "[debug] Navigation completed" << (deadline ? " at the deadline" : "")
+                          << " for new tab: " << op.url << "\n";
+                progress_.Navigated(op);
+                ++successCount_;
+                Finish(op, TabOpState::Navigated, true);
+                co_return;
+            }
+            if (poll.status == NavigationStatus::Failed || deadline) {
+                if (deadline) {
+                    std::cerr << "[warn] Timed out waiting for navigation to complete for: " << op.url << "\n";
+                } else {
+                    std::cerr << "[warn] Navigation failed (error " << poll.error << ") for: " << op.url << "\n";
+                }
+                Fail(op);
+                co_return;
+            }
+            co_await executor_.Sleep(limits_.navigatePollMs);
+        }
+    }
+
+    // Keeps going after the last operation while a given-up tab may still appear, so it is closed.
+    TabTask DispatchNewTabs() {
+        while (unfinished_ > 0 || !lateTabs_.empty()) {
+            double now = shell_.NowMs();
+            lateTabs_.erase(std::remove_if(lateTabs_.begin(), lateTabs_.end(), [now](double until) { return until <= now; }),
+                            lateTabs_.end());
+            if (waiting_.empty() && lateTabs_.empty()) {
+                ReleaseLockIfIdle();
+                if (unfinished_ > 0) {
+                    co_await claimRegistered_.Wait();
+                }
+                continue;
+            }
+
+            std::vector<ShellTab> tabs;
+            if (shell_.EnumerateTabs(tabs)) {
+                for (uintptr_t id : claims_.Claim(FirstWindowTabIds(tabs), waiting_.size() + lateTabs_.size())) {
+                    if (!waiting_.empty()) {
+                        // Operations wait in the order they sent their requests: the first is the oldest.
+                        std::shared_ptr<TabClaim> oldest = waiting_.front();
+                        waiting_.pop_front();
+                        oldest->done = true;
+                        oldest->tab = id;
+                        executor_.Post(oldest->waiter);
+                    } else {
+                        std::cout << "[debug] Closing tab 0x" << std::hex << id << std::dec
+                                  << " that appeared after its request was given up.\n";
+                        shell_.QuitTab(id);
+                        lateTabs_.pop_front();
+                    }
+                }
+            }
+            ReleaseLockIfIdle();
+            co_await executor_.Sleep(limits_.tabPollMs);
+        }
+    }
+
+    TabShell& shell_;
+    uintptr_t firstWindow_;
+    TabProgress& progress_;
+    TabEngineLimits limits_;
+    TabExecutor executor_;
+    TabWaitQueue slotFreed_;
+    TabWaitQueue claimRegistered_;
+    NewTabClaims claims_;
+    std::deque<std::shared_ptr<TabClaim>> waiting_;
+    std::deque<double> lateTabs_; // when each given-up request stops being expected
+    bool lockHeld_ = false;
+    size_t inFlight_ = 0;
+    size_t unfinished_ = 0;
+    size_t successCount_ = 0;
+};
@@ -0,0 +1,165 @@
+// com_ptr_test.cpp - Leak injection test for ComPtr and its reference accounting (any platform)
+// Build: g++ tests/com_ptr_test.cpp -std=c++17 -DTAB_MERGER_COM_ACCOUNTING -I. -o com_ptr_test
+//
+// Fake COM objects count their own references. Balanced use of ComPtr must return every object
+// to its initial count and leave nothing outstanding in the accounting; references leaked on
+// purpose must show up as outstanding at exactly the call site that took them, and the peaks of
+// live references and live objects must match what was held at once, with two interfaces of one
+// object counted as one object. The report printed at exit lists the injected leaks.
+
+#include "com_ptr.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+struct FakeObject {
+    long refs = 1; // the creator's reference
+    long AddRef() { return ++refs; }
+    long Release() { return --refs; }
+};
+
+// An object with two interfaces, like a tab's IDispatch and IWebBrowser2: each interface has its
+// own pointer, but both share the object's reference count and identity.
+struct FakeTab;
+struct FakeInterface {
+    FakeTab* owner;
+    long AddRef();
+    long Release();
+};
+struct FakeDispatch : FakeInterface {};
+struct FakeBrowser : FakeInterface {};
+struct FakeTab {
+    long refs = 1;
+    FakeDispatch dispatch{ { this } };
+    FakeBrowser browser{ { this } };
+};
+long FakeInterface::AddRef() { return ++owner->refs; }
+long FakeInterface::Release() { return --owner->refs; }
+
+TAB_MERGER_COM_INTERFACE(FakeObject)
+TAB_MERGER_COM_INTERFACE(FakeDispatch)
+TAB_MERGER_COM_INTERFACE(FakeBrowser)
+
+template <> const void* ComObjectIdentity<FakeObject>(FakeObject* p) { return p; }
+template <> const void* ComObjectIdentity<FakeDispatch>(FakeDispatch* p) { return p->owner; }
+template <> const void* ComObjectIdentity<FakeBrowser>(FakeBrowser* p) { return p->owner; }
+
+static int g_failures = 0;
+
+static void Check(bool ok, const std::string& what) {
+    if (!ok) {
+        ++g_failures;
+        std::cerr << "FAIL: " << what << "\n";
+    }
+}
+
+// Stands in for a COM call returning an interface through an out-parameter.
+static long GetFake(FakeObject* object, FakeObject** out) {
+    if (!object) {
+        *out = nullptr;
+        return -1;
+    }
+    object->AddRef();
+    *out = object;
+    return 0;
+}
+
+static std::string Site(int line) {
+    return ComPtr<FakeObject>::SiteName(__FILE__, line);
+}
+
+int main() {
+    ComAccounting& accounting = ComAccounting::Get();
+    FakeObject a, b, c;
+
+    // Peaks: three references to a and two to b held at the same time.
+    {
+        ComPtr<FakeObject> a1, a2, a3, b1, b2;
+        GetFake(&a, a1.Put());
+        GetFake(&a, a2.Put());
+        a3.Assign(&a);
+        GetFake(&b, b1.Put());
+        b2.Assign(b1.Get());
+        Check(a.refs == 4 && b.refs == 3, "references taken");
+        Check(accounting.LiveReferences() == 5, "five live references");
+        Check(accounting.LiveObjects() == 2, "two live objects");
+
+        ComPtr<FakeObject> moved(std::move(a1));
+        a2 = std::move(a3); // releases a2's own reference
+        Check(a.refs == 3, "move assignment releases the overwritten reference");
+        Check(accounting.LiveReferences() == 4, "moves keep their references accounted");
+    }
+    Check(a.refs == 1 && b.refs == 1, "all references released at scope exit");
+    Check(accounting.LiveReferences() == 0 && accounting.LiveObjects() == 0, "nothing outstanding");
+    Check(accounting.PeakReferences() == 5, "peak live references");
+    Check(accounting.PeakObjects() == 2, "peak live objects");
+
+    // A failed call leaves nothing to account; Put on a held reference releases it first.
+    {
+        ComPtr<FakeObject> p;
+        GetFake(nullptr, p.Put());
+        Check(!p && accounting.LiveReferences() == 0, "failed call is not accounted");
+        GetFake(&a, p.Put());
+        GetFake(&b, p.Put());
+        Check(a.refs == 1 && b.refs == 2, "Put releases the previous reference");
+        p.Reset();
+        Check(b.refs == 1 && accounting.LiveReferences() == 0, "Reset releases");
+    }
+
+    // Attach takes over the creator's reference instead of adding one.
+    {
+        FakeObject* created = new FakeObject;
+        {
+            ComPtr<FakeObject> owner;
+            owner.Attach(created);
+            Check(created->refs == 1 && accounting.LiveReferences() == 1, "Attach adds no reference");
+        }
+        Check(created->refs == 0 && accounting.LiveReferences() == 0, "attached reference released");
+        delete created;
+    }
+
+    // Two interfaces of one object are one live object, however many references they hold.
+    {
+        FakeTab tab;
+        ComPtr<FakeDispatch> dispatch;
+        ComPtr<FakeBrowser> browser1, browser2;
+        dispatch.Assign(&tab.dispatch);
+        browser1.Assign(&tab.browser);
+        browser2.Assign(&tab.browser);
+        Check(tab.refs == 4, "interfaces share the object's count");
+        Check(accounting.LiveReferences() == 3, "three live references to the tab");
+        Check(accounting.LiveObjects() == 1, "interfaces of one object are one live object");
+        browser1.Reset();
+        dispatch.Reset();
+        Check(accounting.LiveObjects() == 1, "object live while one interface is held");
+        browser2.Reset();
+        Check(tab.refs == 1 && accounting.LiveObjects() == 0, "object released with its last interface");
+    }
+    Check(accounting.PeakObjects() == 2, "peak live objects not raised by a second interface");
+
+    // Leak injection: ComPtrs that are never destroyed, at two call sites.
+    auto* leakedByPut = new ComPtr<FakeObject>;
+    const int putLine = __LINE__; GetFake(&c, leakedByPut->Put());
+    auto* leakedByAssign = new ComPtr<FakeObject>;
+    const int assignLine = __LINE__; leakedByAssign->Assign(&c);
+
+    Check(c.refs == 3, "leaked references still held on the object");
+    Check(accounting.LiveReferences() == 2 && accounting.LiveObjects() == 1, "leaks outstanding on one object");
+    Check(accounting.Outstanding(Site(putLine)) == 1, "leak reported at the Put site " + Site(putLine));
+    Check(accounting.Outstanding(Site(assignLine)) == 1, "leak reported at the Assign site " + Site(assignLine));
+
+    std::ostringstream report;
+    accounting.Report(report);
+    Check(report.str().find("LEAK " + Site(putLine)) != std::string::npos, "report names the Put leak");
+    Check(report.str().find("LEAK " + Site(assignLine)) != std::string::npos, "report names the Assign leak");
+    Check(report.str().find("outstanding at exit: 2 reference(s) to 1 object(s)") != std::string::npos,
+          "report totals the leaks");
+
+    if (g_failures) {
+        std::cerr << "com_ptr_test: " << g_failures << " failure(s)\n";
+        return 1;
+    }
+    std::cout << "com_ptr_test: all checks passed; the report below lists the two injected leaks\n";
+    return 0;
+}
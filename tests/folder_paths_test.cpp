@@ -0,0 +1,250 @@
+// folder_paths_test.cpp - Resolve requested folders against a temporary directory tree (any platform)
+// Build: g++ tests/folder_paths_test.cpp -std=c++17 -pthread -I. -o folder_paths_test
+//
+// Builds a small tree under the temp directory and resolves a missing path, a file, folders given
+// relative, with dot segments and more than once, an empty path and a shell location, first one by
+// one and then as a batch on a worker pool. Slow probes then check the deadlines: a probe that
+// hangs is reported as timed out without holding up the others, a path queued behind a slow probe
+// gets its own deadline once it starts, and one still queued when the batch deadline passes is
+// given up without being probed.
+
+#include "folder_paths.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace std::chrono_literals;
+
+static int g_failures = 0;
+
+static void Check(bool ok, const std::string& scenario, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAIL [" << scenario << "]: " << what << "\n";
+        ++g_failures;
+    }
+}
+
+// A fixed number of worker threads, as the private thread pool of open_folder_tab.
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t threads) {
+        for (size_t i = 0; i < threads; ++i) {
+            threads_.emplace_back([this] { Work(); });
+        }
+    }
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            stopping_ = true;
+        }
+        changed_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    FolderPathResolver::Submit Submitter() {
+        return [this](std::function<void()> task) {
+            {
+                std::lock_guard<std::mutex> lock(lock_);
+                tasks_.push_back(std::move(task));
+            }
+            changed_.notify_one();
+            return true;
+        };
+    }
+
+private:
+    // Drains the queue before stopping, so late probes always run to completion.
+    void Work() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(lock_);
+                changed_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                if (tasks_.empty()) return;
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex lock_;
+    std::condition_variable changed_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+};
+
+// A temporary tree: <root>/folder/nested and the file <root>/folder/file.txt.
+class TempTree {
+public:
+    TempTree() {
+        root_ = fs::temp_directory_path() / ("folder_paths_test-" + std::to_string(std::random_device{}()));
+        fs::create_directories(root_ / "folder" / "nested");
+        std::ofstream(root_ / "folder" / "file.txt") << "not a folder\n";
+    }
+    ~TempTree() {
+        std::error_code ec;
+        fs::remove_all(root_, ec);
+    }
+
+    std::string Path(const std::string& relative) const { return (root_ / relative).string(); }
+    const fs::path& Root() const { return root_; }
+
+private:
+    fs::path root_;
+};
+
+static void ClassifyPaths(const TempTree& tree) {
+    const std::string n = "classify";
+    ResolvedPath folder = ResolveFolderPath(tree.Path("folder"));
+    Check(folder.status == PathStatus::Ok && folder.path == tree.Path("folder"), n, "existing folder accepted as given");
+    Check(ResolveFolderPath(tree.Path("folder/nested")).status == PathStatus::Ok, n, "nested folder accepted");
+    Check(ResolveFolderPath(tree.Path("missing")).status == PathStatus::NotFound, n, "missing folder rejected");
+    Check(ResolveFolderPath(tree.Path("missing/child")).status == PathStatus::NotFound, n, "path under a missing folder rejected");
+    ResolvedPath file = ResolveFolderPath(tree.Path("folder/file.txt"));
+    Check(file.status == PathStatus::NotDirectory && file.error == 0, n, "file rejected as not a folder");
+    Check(ResolveFolderPath("").status == PathStatus::Empty, n, "empty path rejected");
+    ResolvedPath shell = ResolveFolderPath("shell:Downloads");
+    Check(shell.status == PathStatus::Ok && shell.path == "shell:Downloads", n, "shell location passed through");
+
+    ResolvedPath dotted = ResolveFolderPath(tree.Path("folder/nested/./../nested"));
+    Check(dotted.status == PathStatus::Ok && dotted.path == tree.Path("folder/nested"), n,
+          "dot segments removed: " + dotted.path);
+
+    fs::path previous = fs::current_path();
+    fs::current_path(tree.Root());
+    ResolvedPath relative = ResolveFolderPath("folder");
+    fs::current_path(previous);
+    Check(relative.status == PathStatus::Ok && fs::path(relative.path).is_absolute() &&
+              fs::equivalent(relative.path, tree.Path("folder")),
+          n, "relative path made absolute: " + relative.path);
+}
+
+static void ResolveBatch(const TempTree& tree) {
+    const std::string n = "batch";
+    std::atomic<int> probes{ 0 };
+    WorkerPool pool(4);
+    FolderPathResolver resolver(pool.Submitter(), 2000ms, [&](const std::string& input) {
+        ++probes;
+        return ResolveFolderPath(input);
+    });
+    std::vector<std::string> inputs{ tree.Path("folder"), tree.Path("missing"), tree.Path("folder/file.txt"),
+                                     tree.Path("folder"), "",  tree.Path("folder/nested"), tree.Path("folder") };
+    std::vector<ResolvedPath> resolved = resolver.Resolve(inputs);
+
+    Check(resolved.size() == inputs.size(), n, "one result per input");
+    std::vector<PathStatus> expected{ PathStatus::Ok, PathStatus::NotFound, PathStatus::NotDirectory, PathStatus::Ok,
+                                      PathStatus::Empty, PathStatus::Ok, PathStatus::Ok };
+    for (size_t i = 0; i < resolved.size() && i < expected.size(); ++i) {
+        Check(resolved[i].status == expected[i], n, "input " + std::to_string(i) + " classified in input order");
+    }
+    Check(probes == 5, n, "repeated inputs probed once (" + std::to_string(probes) + " probes)");
+
+    // Without workers every probe runs inline.
+    FolderPathResolver unqueued([](std::function<void()>) { return false; }, 2000ms);
+    std::vector<ResolvedPath> direct = unqueued.Resolve({ tree.Path("folder"), tree.Path("missing") });
+    Check(direct.size() == 2 && direct[0].status == PathStatus::Ok && direct[1].status == PathStatus::NotFound, n,
+          "paths resolved inline when they cannot be queued");
+}
+
+// A probe that hangs until released, as an offline share does.
+class Gate {
+public:
+    void Wait() {
+        std::unique_lock<std::mutex> lock(lock_);
+        opened_.wait(lock, [this] { return open_; });
+    }
+    void Open() {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            open_ = true;
+        }
+        opened_.notify_all();
+    }
+
+private:
+    std::mutex lock_;
+    std::condition_variable opened_;
+    bool open_ = false;
+};
+
+static void HungProbe(const TempTree& tree) {
+    const std::string n = "hung probe";
+    const std::string share = "//offline/share";
+    Gate gate;
+    std::atomic<bool> lateProbeFinished{ false };
+    {
+        WorkerPool pool(4);
+        FolderPathResolver resolver(pool.Submitter(), 100ms, [&](const std::string& input) {
+            if (input == share) {
+                gate.Wait();
+                lateProbeFinished = true;
+                return ResolvedPath{ input, PathStatus::Unreachable, 0 };
+            }
+            return ResolveFolderPath(input);
+        });
+        auto start = std::chrono::steady_clock::now();
+        std::vector<ResolvedPath> resolved = resolver.Resolve({ share, tree.Path("folder"), tree.Path("missing") });
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        Check(resolved.size() == 3 && resolved[0].status == PathStatus::TimedOut && resolved[0].path == share, n,
+              "hung probe reported as timed out");
+        Check(resolved.size() == 3 && resolved[1].status == PathStatus::Ok && resolved[2].status == PathStatus::NotFound, n,
+              "other paths resolved while the probe hung");
+        Check(elapsed >= 100ms && elapsed < 1000ms, n, "gave up at the deadline");
+        // The resolver has returned; the hung probe now finishes on its own.
+        gate.Open();
+    }
+    Check(lateProbeFinished, n, "late probe ran to completion after the resolver returned");
+}
+
+static void PerPathDeadlines(const TempTree& tree) {
+    const std::string n = "per-path deadlines";
+    // One worker and probes of 100 ms against a 150 ms deadline: the second path starts at 100 ms,
+    // before the batch deadline, and gets until 250 ms; the third is still queued at 150 ms.
+    std::atomic<int> probes{ 0 };
+    {
+        WorkerPool pool(1);
+        FolderPathResolver resolver(pool.Submitter(), 150ms, [&](const std::string& input) {
+            ++probes;
+            std::this_thread::sleep_for(100ms);
+            return ResolveFolderPath(input);
+        });
+        std::vector<ResolvedPath> resolved =
+            resolver.Resolve({ tree.Path("folder"), tree.Path("folder/nested"), tree.Path("folder/file.txt") });
+        Check(resolved.size() == 3 && resolved[0].status == PathStatus::Ok, n, "first path resolved");
+        Check(resolved.size() == 3 && resolved[1].status == PathStatus::Ok, n,
+              "queued path resolved within its own deadline after the batch deadline");
+        Check(resolved.size() == 3 && resolved[2].status == PathStatus::TimedOut, n,
+              "path still queued at the batch deadline given up");
+    }
+    Check(probes == 2, n, "given up path never probed (" + std::to_string(probes) + " probes)");
+}
+
+int main() {
+    TempTree tree;
+    ClassifyPaths(tree);
+    ResolveBatch(tree);
+    HungProbe(tree);
+    PerPathDeadlines(tree);
+
+    if (g_failures) {
+        std::cerr << "folder_paths_test: " << g_failures << " failure(s)\n";
+        return 1;
+    }
+    std::cout << "folder_paths_test: paths classified, deduplicated and timed out per path\n";
+    return 0;
+}
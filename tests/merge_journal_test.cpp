@@ -0,0 +1,189 @@
+// merge_journal_test.cpp - Crash injection test for the merge journal (any platform)
+// Build: g++ tests/merge_journal_test.cpp -std=c++17 -I. -o merge_journal_test
+//
+// A merge is journaled step by step and the journal is cut at every byte, as if the process had
+// been killed there. Loading each cut journal must report exactly the tabs whose navigated record
+// was completely written. The cuts after the first byte, before the newline and after the newline
+// of each record are then resumed by a second run, which is cut at the same points; the tabs reported
+// moved must always be the union of both runs' completed tabs, and once the second run finishes
+// every tab must be moved exactly once.
+
+#include "merge_journal.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+static const uintptr_t kFirstWindow = 100;
+static const char* kJournalPath = "merge_journal_test.journal";
+
+typedef std::vector<std::pair<uintptr_t, std::string>> TabSet;
+
+static int g_failures = 0;
+
+static TabSet Sorted(const std::vector<JournalItem>& items) {
+    TabSet set;
+    for (const auto& item : items) set.push_back({ item.donor, item.url });
+    std::sort(set.begin(), set.end());
+    return set;
+}
+
+static TabSet Union(TabSet a, const TabSet& b) {
+    a.insert(a.end(), b.begin(), b.end());
+    std::sort(a.begin(), a.end());
+    return a;
+}
+
+static std::string ReadAll(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+static void WriteAll(const std::string& path, const std::string& content) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << content;
+}
+
+static void Check(bool ok, const std::string& what) {
+    if (!ok && ++g_failures <= 10) {
+        std::cerr << "FAIL: " << what << "\n";
+    }
+}
+
+// The journal after each step of a run, and the tabs that run had moved at that point.
+struct Step {
+    size_t offset;
+    TabSet moved;
+};
+
+// Journals a complete merge of items the way merge_tabs does and returns the steps.
+static std::vector<Step> RunMerge(const std::vector<JournalItem>& items) {
+    std::vector<Step> steps;
+    TabSet moved;
+    MergeJournal journal;
+    journal.Open(kJournalPath, kFirstWindow);
+    steps.push_back({ ReadAll(kJournalPath).size(), moved });
+    for (size_t i = 0; i < items.size(); ++i) {
+        journal.Planned(i, items[i]);
+        steps.push_back({ ReadAll(kJournalPath).size(), moved });
+    }
+    for (size_t i = 0; i < items.size(); ++i) {
+        journal.Created(i);
+        steps.push_back({ ReadAll(kJournalPath).size(), moved });
+        journal.Navigated(i);
+        moved = Union(moved, { { items[i].donor, items[i].url } });
+        steps.push_back({ ReadAll(kJournalPath).size(), moved });
+        if (i + 1 == items.size() || items[i + 1].donor != items[i].donor) {
+            journal.Closed(items[i].donor);
+            steps.push_back({ ReadAll(kJournalPath).size(), moved });
+        }
+    }
+    return steps;
+}
+
+static TabSet MovedAt(const std::vector<Step>& steps, size_t cut) {
+    TabSet moved;
+    for (const auto& step : steps) {
+        if (step.offset <= cut) moved = step.moved;
+    }
+    return moved;
+}
+
+// Tabs of the plan that were not moved yet, as the resumed run would queue them.
+static std::vector<JournalItem> Remaining(const std::vector<JournalItem>& plan, TabSet moved) {
+    std::vector<JournalItem> remaining;
+    for (const auto& item : plan) {
+        auto it = std::find(moved.begin(), moved.end(), std::make_pair(item.donor, item.url));
+        if (it != moved.end()) {
+            moved.erase(it);
+        } else {
+            remaining.push_back(item);
+        }
+    }
+    return remaining;
+}
+
+// Cut points inside and around every record from offset on.
+static std::vector<size_t> RecordCuts(const std::string& journal, size_t offset) {
+    std::vector<size_t> cuts{ offset };
+    for (size_t start = offset; start < journal.size();) {
+        size_t newline = journal.find('\n', start);
+        if (newline == std::string::npos) break;
+        cuts.insert(cuts.end(), { start + 1, newline, newline + 1 });
+        start = newline + 1;
+    }
+    return cuts;
+}
+
+int main() {
+    // More than ten tabs so indices have two digits ("navigated\t12" can be torn to "...\t1"),
+    // and one donor holds the same location twice.
+    std::vector<JournalItem> plan;
+    for (int i = 0; i < 13; ++i) {
+        plan.push_back({ "file:///C:/folder" + std::to_string(i % 11), (uintptr_t)(200 + i / 4) });
+    }
+
+    std::remove(kJournalPath);
+    std::vector<Step> firstRun = RunMerge(plan);
+    std::string firstJournal = ReadAll(kJournalPath);
+
+    std::vector<size_t> resumeFrom = RecordCuts(firstJournal, 0);
+    size_t cuts = 0;
+    for (size_t cut = 0; cut <= firstJournal.size(); ++cut) {
+        std::string prefix = firstJournal.substr(0, cut);
+        WriteAll(kJournalPath, prefix);
+        TabSet expected = MovedAt(firstRun, cut);
+        TabSet loaded = Sorted(MergeJournal::LoadMoved(kJournalPath, kFirstWindow));
+        Check(loaded == expected, "first run cut at byte " + std::to_string(cut));
+        Check(MergeJournal::LoadMoved(kJournalPath, kFirstWindow + 1).empty(),
+              "other first window, cut at byte " + std::to_string(cut));
+        ++cuts;
+        if (std::find(resumeFrom.begin(), resumeFrom.end(), cut) == resumeFrom.end()) {
+            continue;
+        }
+
+        // Resume from this cut and interrupt the resumed run in and between all of its records.
+        std::vector<JournalItem> remaining = Remaining(plan, loaded);
+        std::vector<Step> secondRun = RunMerge(remaining);
+        std::string secondJournal = ReadAll(kJournalPath);
+        size_t kept = prefix.find_last_of('\n');
+        kept = kept == std::string::npos ? 0 : kept + 1;
+        std::string planRecord = "plan\t" + std::to_string(kFirstWindow) + "\n";
+        Check(secondJournal.compare(0, kept, prefix, 0, kept) == 0 &&
+                  secondJournal.compare(kept, planRecord.size(), planRecord) == 0,
+              "torn record cut off before resuming from byte " + std::to_string(cut));
+
+        for (size_t secondCut : RecordCuts(secondJournal, kept)) {
+            WriteAll(kJournalPath, secondJournal.substr(0, secondCut));
+            TabSet secondMoved;
+            for (const auto& step : secondRun) {
+                if (step.offset <= secondCut) secondMoved = step.moved;
+            }
+            TabSet both = Sorted(MergeJournal::LoadMoved(kJournalPath, kFirstWindow));
+            Check(both == Union(loaded, secondMoved),
+                  "resumed from byte " + std::to_string(cut) + ", cut at byte " + std::to_string(secondCut));
+            ++cuts;
+        }
+        WriteAll(kJournalPath, secondJournal);
+        Check(Sorted(MergeJournal::LoadMoved(kJournalPath, kFirstWindow)) == Sorted(plan),
+              "every tab moved exactly once after resuming from byte " + std::to_string(cut));
+    }
+
+    MergeJournal finished;
+    finished.Open(kJournalPath, kFirstWindow);
+    finished.Finish();
+    Check(!std::ifstream(kJournalPath), "journal removed when the merge finishes");
+    std::remove(kJournalPath);
+
+    if (g_failures) {
+        std::cerr << "merge_journal_test: " << g_failures << " failure(s) in " << cuts << " interrupted journals\n";
+        return 1;
+    }
+    std::cout << "merge_journal_test: " << cuts << " interrupted journals recovered correctly\n";
+    return 0;
+}
@@ -0,0 +1,319 @@
+// merge_scheduler_test.cpp - Stress the merge slot protocol with many simulated sessions (any platform)
+// Build: g++ tests/merge_scheduler_test.cpp -std=c++17 -pthread -I. -o merge_scheduler_test
+//
+// Each merge_tabs process is a thread running MergeSlotHolder against an in-process host whose
+// session locks and slots behave like the named mutexes: waiters are served in arrival order and
+// an object whose owner dies is handed to the next waiter as abandoned. Interactive and background
+// merges of many sessions start at once and some of them die while holding their slots. The host
+// checks the protocol on every grant: no slot is held or waited for without the session lock, a
+// background merge takes a background slot before a global one, and the caps hold. Afterwards
+// every abandoned object must have been taken over, the full capacity must still be available, and
+// the wait statistics must come out of the slot log format as recorded.
+
+#include "merge_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const unsigned kProcessors = 8;
+static const size_t kSessions = 40;
+static const size_t kProcesses = 200;
+static const size_t kDieEvery = 17;
+
+static int g_failures = 0;
+static std::mutex g_checkLock;
+
+static void Check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::lock_guard<std::mutex> lock(g_checkLock);
+        std::cerr << "FAIL: " << what << "\n";
+        ++g_failures;
+    }
+}
+
+static uint32_t SteadyMs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// A set of interchangeable mutexes (one session lock, or the slots of one class) with a FIFO queue.
+struct SimObjectGroup {
+    std::vector<size_t> owner; // process + 1, or 0 when free
+    std::vector<bool> abandoned;
+    std::deque<size_t> queue;
+
+    explicit SimObjectGroup(size_t count) : owner(count, 0), abandoned(count, false) {}
+
+    size_t Free() const {
+        for (size_t i = 0; i < owner.size(); ++i) {
+            if (!owner[i]) return i;
+        }
+        return owner.size();
+    }
+    size_t Held(size_t process) const {
+        size_t held = 0;
+        for (size_t o : owner) held += o == process + 1 ? 1 : 0;
+        return held;
+    }
+};
+
+struct SimProcess {
+    size_t session;
+    bool background;
+    bool dies;
+};
+
+class SimHost {
+public:
+    SimHost(MergeSlotCounts counts, const std::vector<SimProcess>& processes)
+        : counts_(counts), processes_(processes), global_(counts.slots), background_(counts.backgroundSlots) {
+        for (size_t i = 0; i < kSessions; ++i) sessions_.emplace_back(1);
+    }
+
+    SlotWait WaitSession(size_t process, uint32_t timeoutMs) {
+        std::unique_lock<std::mutex> lock(lock_);
+        Check(!global_.Held(process) && !background_.Held(process),
+              "process " + std::to_string(process) + " holds a host slot while queued for its session");
+        return Wait(lock, Session(process), process, timeoutMs, nullptr);
+    }
+
+    SlotWait WaitSlot(size_t process, bool background, uint32_t timeoutMs, size_t& index) {
+        std::unique_lock<std::mutex> lock(lock_);
+        Check(Session(process).Held(process) == 1,
+              "process " + std::to_string(process) + " waits for a host slot without its session lock");
+        if (!background && processes_[process].background) {
+            Check(background_.Held(process) == 1,
+                  "background process " + std::to_string(process) + " waits for a global slot without a background slot");
+        }
+        return Wait(lock, background ? background_ : global_, process, timeoutMs, &index);
+    }
+
+    void Release(size_t process, SimObjectGroup& group, size_t index) {
+        std::lock_guard<std::mutex> lock(lock_);
+        // A dead process releases nothing; its objects were already abandoned.
+        if (group.owner[index] == process + 1) {
+            group.owner[index] = 0;
+            changed_.notify_all();
+        }
+    }
+
+    // The process exits without releasing: everything it owns is abandoned.
+    void Die(size_t process) {
+        std::lock_guard<std::mutex> lock(lock_);
+        for (SimObjectGroup* group : Groups()) {
+            for (size_t i = 0; i < group->owner.size(); ++i) {
+                if (group->owner[i] == process + 1) {
+                    group->owner[i] = 0;
+                    group->abandoned[i] = true;
+                    ++abandonedCreated_;
+                }
+            }
+        }
+        changed_.notify_all();
+    }
+
+    // Counts a merge running in its session; Leave undoes it.
+    void Enter(size_t process) {
+        std::lock_guard<std::mutex> lock(lock_);
+        size_t session = processes_[process].session;
+        Check(++running_[session] == 1, "two merges ran at once in session " + std::to_string(session));
+        ++runningTotal_;
+        maxRunning_ = std::max(maxRunning_, runningTotal_);
+    }
+    void Leave(size_t process) {
+        std::lock_guard<std::mutex> lock(lock_);
+        --running_[processes_[process].session];
+        --runningTotal_;
+    }
+
+    SimObjectGroup& Session(size_t process) { return sessions_[processes_[process].session]; }
+    SimObjectGroup& Slots(bool background) { return background ? background_ : global_; }
+    size_t AbandonedCreated() const { return abandonedCreated_; }
+    size_t MaxRunning() const { return maxRunning_; }
+    size_t MaxBackgroundGlobal() const { return maxBackgroundGlobal_; }
+
+private:
+    std::vector<SimObjectGroup*> Groups() {
+        std::vector<SimObjectGroup*> groups{ &global_, &background_ };
+        for (auto& session : sessions_) groups.push_back(&session);
+        return groups;
+    }
+
+    SlotWait Wait(std::unique_lock<std::mutex>& lock, SimObjectGroup& group, size_t process, uint32_t timeoutMs, size_t* index) {
+        group.queue.push_back(process);
+        auto ready = [&] { return group.queue.front() == process && group.Free() < group.owner.size(); };
+        if (!changed_.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready)) {
+            group.queue.erase(std::find(group.queue.begin(), group.queue.end(), process));
+            changed_.notify_all();
+            return SlotWait::TimedOut;
+        }
+        group.queue.pop_front();
+        size_t i = group.Free();
+        group.owner[i] = process + 1;
+        if (index) *index = i;
+        if (&group == &global_) {
+            size_t backgroundHeld = 0;
+            for (size_t o : global_.owner) backgroundHeld += o && processes_[o - 1].background ? 1 : 0;
+            maxBackgroundGlobal_ = std::max(maxBackgroundGlobal_, backgroundHeld);
+            Check(backgroundHeld <= counts_.backgroundSlots, "background merges hold more global slots than their share");
+        }
+        bool abandoned = group.abandoned[i];
+        group.abandoned[i] = false;
+        changed_.notify_all();
+        return abandoned ? SlotWait::Abandoned : SlotWait::Acquired;
+    }
+
+    MergeSlotCounts counts_;
+    const std::vector<SimProcess>& processes_;
+    std::mutex lock_;
+    std::condition_variable changed_;
+    SimObjectGroup global_;
+    SimObjectGroup background_;
+    std::deque<SimObjectGroup> sessions_;
+    std::vector<size_t> running_ = std::vector<size_t>(kSessions, 0);
+    size_t runningTotal_ = 0;
+    size_t maxRunning_ = 0;
+    size_t maxBackgroundGlobal_ = 0;
+    size_t abandonedCreated_ = 0;
+};
+
+class SimProcessSlots : public MergeSlotObjects {
+public:
+    SimProcessSlots(SimHost& host, size_t process) : host_(host), process_(process) {}
+
+    SlotWait WaitSession(uint32_t timeoutMs) override { return host_.WaitSession(process_, timeoutMs); }
+    void ReleaseSession() override { host_.Release(process_, host_.Session(process_), 0); }
+    SlotWait WaitAnySlot(bool background, uint32_t timeoutMs, size_t& index) override {
+        return host_.WaitSlot(process_, background, timeoutMs, index);
+    }
+    void ReleaseSlot(bool background, size_t index) override { host_.Release(process_, host_.Slots(background), index); }
+    uint32_t NowMs() override { return SteadyMs(); }
+
+private:
+    SimHost& host_;
+    size_t process_;
+};
+
+struct SimOutcome {
+    std::string record;
+    size_t abandoned = 0;
+};
+
+int main() {
+    MergeSlotCounts counts = HostSlotCounts(kProcessors);
+    Check(counts.slots == 4 && counts.backgroundSlots == 2, "slot counts for 8 processors");
+    Check(HostSlotCounts(1).slots == 2 && HostSlotCounts(1).backgroundSlots == 1, "slot counts for 1 processor");
+    Check(HostSlotCounts(1024).slots == kMaxMergeSlots, "slot count capped at one wait's worth of handles");
+
+    std::mt19937 random(27);
+    // The merges, then one sweeper per session.
+    std::vector<SimProcess> processes(kProcesses);
+    std::vector<uint32_t> holdMs(kProcesses);
+    for (size_t i = 0; i < kProcesses; ++i) {
+        processes[i] = { random() % kSessions, random() % 10 < 3, i % kDieEvery == kDieEvery - 1 };
+        holdMs[i] = 1 + random() % 5;
+    }
+    for (size_t s = 0; s < kSessions; ++s) {
+        processes.push_back({ s, s < counts.backgroundSlots, false });
+    }
+
+    SimHost host(counts, processes);
+    std::vector<SimOutcome> outcomes(kProcesses);
+    std::mutex startLock;
+    std::condition_variable startSignal;
+    bool started = false;
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < kProcesses; ++p) {
+        threads.emplace_back([&, p] {
+            {
+                std::unique_lock<std::mutex> lock(startLock);
+                startSignal.wait(lock, [&] { return started; });
+            }
+            SimProcessSlots objects(host, p);
+            MergeSlotHolder holder(objects);
+            bool background = processes[p].background;
+            MergeSlotStatus status = holder.Acquire(background, background ? 300000 : 60000);
+            bool acquired = status == MergeSlotStatus::Acquired;
+            if (acquired) {
+                host.Enter(p);
+                std::this_thread::sleep_for(std::chrono::milliseconds(holdMs[p]));
+                host.Leave(p);
+                if (processes[p].dies) host.Die(p);
+            }
+            holder.Release();
+            outcomes[p].abandoned = holder.Abandoned();
+            outcomes[p].record = FormatSlotLogRecord((uint32_t)processes[p].session, background, acquired,
+                                                     holder.WaitMs(), holder.HeldMs());
+        });
+    }
+    {
+        std::lock_guard<std::mutex> lock(startLock);
+        started = true;
+    }
+    startSignal.notify_all();
+    for (auto& t : threads) t.join();
+
+    std::vector<SlotWaitSample> samples;
+    std::vector<double> interactiveWaits, backgroundWaits;
+    size_t recovered = 0, timedOut = 0;
+    for (const auto& outcome : outcomes) {
+        SlotWaitSample s{};
+        Check(ParseSlotLogRecord(outcome.record, s), "slot log record parses: " + outcome.record);
+        samples.push_back(s);
+        (s.background ? backgroundWaits : interactiveWaits).push_back(s.waitMs);
+        timedOut += s.acquired ? 0 : 1;
+        recovered += outcome.abandoned;
+    }
+
+    Check(timedOut == 0, std::to_string(timedOut) + " merge(s) timed out");
+    Check(host.MaxRunning() == counts.slots, "merges ran " + std::to_string(host.MaxRunning()) + " at a time, not up to the cap");
+    Check(host.MaxBackgroundGlobal() == counts.backgroundSlots, "background merges reached their share of the slots");
+    Check(host.AbandonedCreated() > 0, "some merges died holding their slots");
+
+    // Afterwards one process per session takes its session lock and, between them, every slot at
+    // once: nothing was lost to a dead merge, and every abandoned object is taken over exactly once.
+    std::vector<std::unique_ptr<SimProcessSlots>> sweepers;
+    for (size_t s = 0; s < kSessions; ++s) {
+        size_t p = kProcesses + s;
+        sweepers.push_back(std::make_unique<SimProcessSlots>(host, p));
+        SimProcessSlots& objects = *sweepers.back();
+        size_t index = 0;
+        std::vector<SlotWait> waits{ objects.WaitSession(0) };
+        if (processes[p].background) waits.push_back(objects.WaitAnySlot(true, 0, index));
+        if (s < counts.slots) waits.push_back(objects.WaitAnySlot(false, 0, index));
+        for (SlotWait wait : waits) {
+            Check(wait == SlotWait::Acquired || wait == SlotWait::Abandoned, "session " + std::to_string(s) + " sweep got its objects");
+            recovered += wait == SlotWait::Abandoned ? 1 : 0;
+        }
+    }
+    Check(recovered == host.AbandonedCreated(), std::to_string(recovered) + " of " + std::to_string(host.AbandonedCreated()) +
+                                                    " abandoned object(s) taken over");
+
+    double worstMean = 0.0;
+    uint32_t worstSession = 0;
+    double fairness = SlotWaitFairness(samples, worstSession, worstMean);
+    Check(Percentile(interactiveWaits, 0.50) <= Percentile(backgroundWaits, 0.50), "interactive merges wait less than background ones");
+    Check(fairness > 0.5, "slot waits spread across sessions (fairness " + std::to_string(fairness) + ")");
+
+    std::ostringstream stats;
+    PrintSlotStats(samples, stats);
+    std::cout << stats.str();
+
+    if (g_failures) {
+        std::cerr << "merge_scheduler_test: " << g_failures << " failure(s)\n";
+        return 1;
+    }
+    std::cout << "merge_scheduler_test: " << kProcesses << " merges in " << kSessions << " sessions kept the caps, "
+              << host.AbandonedCreated() << " abandoned object(s) recovered\n";
+    return 0;
+}
@@ -0,0 +1,174 @@
+// new_tab_lock_test.cpp - Concurrent callers of the new tab protocol against a simulated Explorer (any platform)
+// Build: g++ tests/new_tab_lock_test.cpp -std=c++17 -pthread -I. -o new_tab_lock_test
+//
+// Fifty callers start at once, as when a script launches many open_folder_tab processes, and each
+// opens one tab the way open_folder_tab does: take the lock, record the first window's tabs, send
+// the new tab command, claim the tab that appears and navigate it. A std::timed_mutex stands in for
+// the named mutex. The simulated Explorer creates each requested tab after a random delay on its
+// own thread, and lists tabs in an order that does not follow creation. Every caller must end up
+// with its own new tab, every new tab must be navigated exactly once, and tabs that were open
+// before must be left alone. The throughput of the serialized protocol is printed.
+
+#include "new_tab_lock.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const int kCallers = 50;
+static const int kTabsOpenBefore = 3;
+static const uint32_t kClaimTimeoutMs = 8000;
+static const uint32_t kClaimRetryMs = 1;
+
+static int g_failures = 0;
+static std::mutex g_failuresMutex;
+
+static void Check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::lock_guard<std::mutex> guard(g_failuresMutex);
+        ++g_failures;
+        std::cerr << "FAIL: " << what << "\n";
+    }
+}
+
+// The first Explorer window: new tab commands are queued and served by a separate thread, like
+// explorer.exe creating the tab after SendMessage has returned.
+class SimulatedExplorer {
+public:
+    SimulatedExplorer() : worker_([this] { Serve(); }) {
+        for (int i = 0; i < kTabsOpenBefore; ++i) tabs_.push_back(nextId_++);
+    }
+    ~SimulatedExplorer() {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        worker_.join();
+    }
+
+    void RequestNewTab() {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            ++requests_;
+        }
+        wake_.notify_all();
+    }
+
+    std::vector<uintptr_t> Tabs() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return tabs_;
+    }
+
+    void Navigate(uintptr_t id, const std::string& url) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        navigations_[id].push_back(url);
+    }
+
+    std::map<uintptr_t, std::vector<std::string>> Navigations() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return navigations_;
+    }
+
+private:
+    void Serve() {
+        std::mt19937 random(26);
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            wake_.wait(lock, [this] { return stopping_ || requests_ > 0; });
+            if (stopping_) return;
+            --requests_;
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::microseconds(random() % 2000));
+            lock.lock();
+            // Explorer's list is not in creation order: new tabs are inserted anywhere.
+            tabs_.insert(tabs_.begin() + random() % (tabs_.size() + 1), nextId_++);
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::vector<uintptr_t> tabs_;
+    std::map<uintptr_t, std::vector<std::string>> navigations_;
+    uintptr_t nextId_ = 1000;
+    int requests_ = 0;
+    bool stopping_ = false;
+    std::thread worker_;
+};
+
+// One caller's view of the shell, as FirstWindowShell in open_folder_tab.
+struct CallerShell {
+    SimulatedExplorer& explorer;
+
+    bool FirstWindowTabs(std::vector<uintptr_t>& ids) {
+        ids = explorer.Tabs();
+        return true;
+    }
+    void RequestNewTab() { explorer.RequestNewTab(); }
+    void Wait(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+};
+
+int main() {
+    SimulatedExplorer explorer;
+    std::vector<uintptr_t> openBefore = explorer.Tabs();
+    std::timed_mutex newTabLock;
+    std::vector<uintptr_t> claimed(kCallers, 0);
+    std::atomic<bool> go{ false };
+
+    std::vector<std::thread> callers;
+    for (int i = 0; i < kCallers; ++i) {
+        callers.emplace_back([&, i] {
+            while (!go) std::this_thread::yield();
+            if (!newTabLock.try_lock_for(std::chrono::seconds(60))) {
+                return;
+            }
+            CallerShell shell{ explorer };
+            NewTabClaims claims;
+            std::vector<uintptr_t> baseline;
+            shell.FirstWindowTabs(baseline);
+            claims.AddKnown(baseline);
+            uintptr_t tab = RequestAndClaimNewTab(shell, claims, kClaimTimeoutMs, kClaimRetryMs);
+            if (tab) {
+                explorer.Navigate(tab, "C:\\folder" + std::to_string(i));
+            }
+            claimed[i] = tab;
+            newTabLock.unlock();
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    for (auto& t : callers) t.join();
+    double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::map<uintptr_t, int> owners;
+    for (int i = 0; i < kCallers; ++i) {
+        Check(claimed[i] != 0, "caller " + std::to_string(i) + " got a tab");
+        Check(++owners[claimed[i]] == 1, "caller " + std::to_string(i) + " has a tab of its own");
+    }
+    auto navigations = explorer.Navigations();
+    for (uintptr_t id : openBefore) {
+        Check(navigations.count(id) == 0, "tab open before was not navigated");
+    }
+    for (int i = 0; i < kCallers; ++i) {
+        auto it = navigations.find(claimed[i]);
+        Check(it != navigations.end() && it->second.size() == 1 && it->second[0] == "C:\\folder" + std::to_string(i),
+              "tab of caller " + std::to_string(i) + " navigated once, to its own folder");
+    }
+    Check(explorer.Tabs().size() == (size_t)(kTabsOpenBefore + kCallers), "one new tab per caller");
+
+    if (g_failures) {
+        std::cerr << "new_tab_lock_test: " << g_failures << " failure(s)\n";
+        return 1;
+    }
+    std::cout << "new_tab_lock_test: " << kCallers << " concurrent callers each got their own tab in "
+              << (long)elapsedMs << " ms (" << (long)(kCallers * 1000.0 / elapsedMs) << " tabs/s)\n";
+    return 0;
+}
@@ -0,0 +1,159 @@
+// shell_trace_test.cpp - Record, parse and replay a merge through the shell trace (any platform)
+// Build: g++ tests/shell_trace_test.cpp -std=c++20 -I. -o shell_trace_test
+//
+// A merge is run through the tab engine against the simulated Explorer with TracedTabShell
+// recording, as merge_tabs --record does, after the tab host lookup that merge_tabs records
+// without detail. The merge has tabs that appear late and out of order, one that appears after its
+// request was given up, and navigations that fail, hang and lose their events. The trace text is
+// then parsed and the merge replayed through the engine with nothing behind TracedTabShell, as
+// merge_tabs --replay does. The replay must find the tab host, consume every recorded call and
+// reproduce each operation's outcome, tab and timing. The parser is also fed CRLF line endings,
+// empty fields and malformed lines.
+
+#include "shell_trace.h"
+#include "sim_shell.h"
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const uintptr_t kTabHost = 4242;
+static const size_t kOperations = 8;
+
+// Records with the simulated Explorer's virtual time.
+class SimTraceClock : public TraceClock {
+public:
+    explicit SimTraceClock(SimShell& shell) : shell_(shell) {}
+    double NowMs() override { return shell_.NowMs(); }
+    void WaitUntil(double ms) override {
+        if (ms > shell_.NowMs()) shell_.WaitForEvents(ms - shell_.NowMs());
+    }
+
+private:
+    SimShell& shell_;
+};
+
+// Replays on a virtual clock that only moves while the replay waits.
+class VirtualTraceClock : public TraceClock {
+public:
+    double NowMs() override { return now_; }
+    void WaitUntil(double ms) override { now_ = std::max(now_, ms); }
+
+private:
+    double now_ = 0.0;
+};
+
+static std::vector<TabOperation> MakeOperations() {
+    std::vector<TabOperation> ops(kOperations);
+    for (size_t i = 0; i < ops.size(); ++i) {
+        ops[i].url = FolderUrl(i);
+        ops[i].donor = kOtherWindow;
+        ops[i].journalIndex = i;
+    }
+    return ops;
+}
+
+static void RunEngine(TabShell& shell, std::vector<TabOperation>& ops) {
+    TabProgress progress;
+    std::streambuf* out = std::cout.rdbuf(nullptr);
+    std::streambuf* err = std::cerr.rdbuf(nullptr);
+    TabEngine engine(shell, kFirstWindow, progress);
+    engine.Run(ops);
+    std::cout.rdbuf(out);
+    std::cerr.rdbuf(err);
+}
+
+static void ParseTrace() {
+    const std::string n = "parse";
+    Check(SplitTraceLine("a\t\tb\t").size() == 4, n, "empty fields kept, including the last one");
+
+    std::istringstream in("collect\t1.000\t0.500\t1\t1\r\n"
+                          "tab\t5\t100\tC:\\with space\r\n"
+                          "call\ttabhost\t0.000\t0.250\t100\t4242\t\r\n"
+                          "\n"
+                          "call\tnavigate\t1.000\t2.000\t5\t0\tC:\\with space\n"
+                          "call\tsend\tnot-a-number\t0\t1\t0\t\n"
+                          "bogus\n");
+    VirtualTraceClock clock;
+    ShellTrace trace(clock);
+    std::ostringstream warnings;
+    trace.Load(in, warnings);
+    Check(trace.Mode() == TraceMode::Replay, n, "loaded for replay");
+    Check(trace.Snapshots().size() == 1 && trace.Snapshots()[0].tabs.size() == 1 &&
+              trace.Snapshots()[0].tabs[0].url == "C:\\with space" && trace.Snapshots()[0].tabs[0].window == 100,
+          n, "snapshot and its tab read");
+    Check(trace.Calls().size() == 2, n, "both well-formed calls read");
+    std::string reported = warnings.str();
+    Check(std::count(reported.begin(), reported.end(), '\n') == 2, n, "two malformed lines reported");
+
+    long long host = 0;
+    Check(trace.ReplayCall("tabhost", 100, host) && host == 4242, n, "tab host call without detail replayed");
+    Check(clock.NowMs() == 0.25, n, "replayed call took its recorded duration");
+}
+
+static void RecordAndReplay() {
+    const std::string n = "round trip";
+    SimConfig config;
+    // Tabs appear out of order; the last one only after its request was given up.
+    config.tabDelay = [](int r) { return r == (int)kOperations - 1 ? 9000.0 : 80.0 + 170.0 * (r % 3); };
+    config.navigateDelay = [](const std::string& url) { return 150.0 + 40.0 * url.back(); };
+    config.navigation = [](const std::string& url) {
+        return url == FolderUrl(5) ? SimNavigation::Fails
+             : url == FolderUrl(6) ? SimNavigation::Hangs
+             : url == FolderUrl(4) ? SimNavigation::EventsLost
+                                   : SimNavigation::Completes;
+    };
+
+    SimShell sim(n, config);
+    SimTraceClock recordClock(sim);
+    ShellTrace recording(recordClock);
+    std::ostringstream text;
+    recording.RecordTo(text);
+    recording.RecordCall("tabhost", recording.NowMs(), kFirstWindow, kTabHost, std::string());
+    std::vector<TabOperation> recorded = MakeOperations();
+    TracedTabShell recorder(recording, &sim, kTabHost);
+    RunEngine(recorder, recorded);
+
+    VirtualTraceClock replayClock;
+    ShellTrace replay(replayClock);
+    std::istringstream in(text.str());
+    std::ostringstream warnings;
+    replay.Load(in, warnings);
+    Check(warnings.str().empty(), n, "recorded trace parses without warnings: " + warnings.str());
+
+    long long host = 0;
+    Check(replay.ReplayCall("tabhost", kFirstWindow, host) && host == (long long)kTabHost, n, "tab host found on replay");
+    std::vector<TabOperation> replayed = MakeOperations();
+    TracedTabShell replayer(replay, nullptr, kTabHost);
+    RunEngine(replayer, replayed);
+    Check(replay.UnconsumedCalls() == 0, n, "every recorded call replayed");
+
+    size_t navigated = 0;
+    for (size_t i = 0; i < kOperations; ++i) {
+        const TabOperation& a = recorded[i];
+        const TabOperation& b = replayed[i];
+        std::string which = "operation " + std::to_string(i);
+        navigated += a.state == TabOpState::Navigated ? 1 : 0;
+        Check(a.state == b.state && a.tab == b.tab, n, which + " replayed with the same outcome and tab");
+        Check(std::fabs(a.requestedAt - b.requestedAt) < 1 && std::fabs(a.completedAt - b.completedAt) < 1, n,
+              which + " replayed with the recorded timing");
+    }
+    // 0-3 complete, 4 completes at the deadline, 5 fails, 6 hangs and 7 never gets its tab.
+    Check(navigated == 5, n, "recorded merge navigated the expected tabs (" + std::to_string(navigated) + ")");
+    Check(sim.quits_.size() == 3, n, "failed, hung and late tabs closed while recording");
+    Check(std::fabs(recordClock.NowMs() - replayClock.NowMs()) < 1, n, "replay took as long as the recorded merge");
+}
+
+int main() {
+    ParseTrace();
+    RecordAndReplay();
+
+    if (g_failures) {
+        std::cerr << "shell_trace_test: " << g_failures << " failure(s)\n";
+        return 1;
+    }
+    std::cout << "shell_trace_test: recorded merge parsed and replayed with the same outcomes and timing\n";
+    return 0;
+}
@@ -0,0 +1,192 @@
+// sim_shell.h - Simulated Explorer on a virtual clock for the tab engine tests (any platform)
+#pragma once
+
+#include "tab_engine.h"
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+static const uintptr_t kFirstWindow = 100;
+static const uintptr_t kOtherWindow = 200;
+static const double kNever = 1e18;
+static const long kNavigateRejected = -2147467259L; // E_FAIL
+static const long kNavigateErrorCode = -2146697211L; // INET_E_RESOURCE_NOT_FOUND
+
+static int g_failures = 0;
+
+static void Check(bool ok, const std::string& scenario, const std::string& what) {
+    if (!ok) {
+        ++g_failures;
+        std::cerr << "FAIL [" << scenario << "]: " << what << "\n";
+    }
+}
+
+static std::string FolderUrl(size_t i) { return "C:\\folder" + std::to_string(i); }
+
+// How the navigation of a folder ends.
+enum class SimNavigation { Completes, Fails, Rejected, Hangs, EventsLost };
+
+struct SimConfig {
+    std::function<double(int request)> tabDelay = [](int) { return 100.0; };
+    std::function<double(const std::string& url)> navigateDelay = [](const std::string&) { return 100.0; };
+    std::function<SimNavigation(const std::string& url)> navigation = [](const std::string&) {
+        return SimNavigation::Completes;
+    };
+    double otherLockUntil = 0;  // another process holds the new tab lock until then...
+    double otherTabAt = kNever; // ...and its new tab appears in the first window at this time
+    double cancelAt = kNever;
+    unsigned seed = 34;         // where new tabs are inserted in the enumeration order
+};
+
+// Explorer as the tab engine sees it. Its clock only advances while the engine waits, so timeouts
+// of seconds run in microseconds and every run is reproducible. Each scenario decides when the tab
+// of each new tab request appears (or never), how each navigation ends, when another process holds
+// the new tab lock and when Ctrl+C comes. Three tabs are open in the first window beforehand and
+// two in a donor window.
+class SimShell : public TabShell {
+public:
+    SimShell(const std::string& scenario, const SimConfig& config) : scenario_(scenario), config_(config), random_(config.seed) {
+        for (uintptr_t id = 1; id <= 3; ++id) tabs_.push_back({ id, kFirstWindow, "C:\\before" + std::to_string(id) });
+        for (uintptr_t id = 11; id <= 12; ++id) tabs_.push_back({ id, kOtherWindow, "C:\\donor" + std::to_string(id) });
+        if (config_.otherTabAt < kNever) {
+            events_.emplace(config_.otherTabAt, [this] { otherTab_ = InsertTab(); });
+        }
+    }
+
+    bool EnumerateTabs(std::vector<ShellTab>& tabs) override {
+        tabs = tabs_;
+        return true;
+    }
+
+    void RequestNewTab() override {
+        Check(lockHeld_, scenario_, "new tab requested while holding the lock");
+        int request = (int)requestTimes_.size();
+        requestTimes_.push_back(now_);
+        maxBusy_ = std::max(maxBusy_, requestTimes_.size() - finished_);
+        double delay = config_.tabDelay(request);
+        if (delay < kNever) {
+            events_.emplace(now_ + delay, [this, request] { createdTabs_[request] = InsertTab(); });
+        }
+    }
+
+    long Navigate(uintptr_t tab, const std::string& url) override {
+        navigations_[tab].push_back(url);
+        if (!IsOpen(tab)) return kNavigateRejected;
+        SimNavigation how = config_.navigation(url);
+        if (how == SimNavigation::Rejected) return kNavigateRejected;
+        pending_[tab] = { how, now_ + config_.navigateDelay(url) };
+        return 0;
+    }
+
+    NavigationPoll PollNavigation(uintptr_t tab, bool deadline) override {
+        auto it = pending_.find(tab);
+        if (it == pending_.end()) return { NavigationStatus::Failed, 0 };
+        bool done = now_ >= it->second.doneAt;
+        NavigationPoll poll = { NavigationStatus::Pending, 0 };
+        switch (it->second.how) {
+        case SimNavigation::Completes:
+            if (done) poll.status = NavigationStatus::Complete;
+            break;
+        case SimNavigation::Fails:
+            if (done) poll = { NavigationStatus::Failed, kNavigateErrorCode };
+            break;
+        case SimNavigation::EventsLost:
+            // Only the last check at the deadline looks at the tab itself.
+            if (deadline && done) poll.status = NavigationStatus::Complete;
+            break;
+        default:
+            break;
+        }
+        if (deadline && poll.status == NavigationStatus::Pending) poll.status = NavigationStatus::Failed;
+        if (poll.status != NavigationStatus::Pending) {
+            pending_.erase(it);
+            if (poll.status == NavigationStatus::Complete) ++finished_;
+        }
+        return poll;
+    }
+
+    long QuitTab(uintptr_t tab) override {
+        pending_.erase(tab);
+        quits_.push_back(tab);
+        ++finished_;
+        for (auto it = tabs_.begin(); it != tabs_.end(); ++it) {
+            if (it->id == tab) {
+                tabs_.erase(it);
+                return 0;
+            }
+        }
+        return kNavigateRejected;
+    }
+
+    bool TryLockNewTabs() override {
+        if (now_ < config_.otherLockUntil) return false;
+        Check(!lockHeld_, scenario_, "lock taken twice");
+        lockHeld_ = true;
+        return true;
+    }
+
+    void UnlockNewTabs() override {
+        Check(lockHeld_, scenario_, "lock released without being held");
+        lockHeld_ = false;
+        unlockTimes_.push_back(now_);
+    }
+
+    double NowMs() override { return now_; }
+
+    void WaitForEvents(double ms) override {
+        double until = now_ + ms;
+        while (!events_.empty() && events_.begin()->first <= until) {
+            now_ = std::max(now_, events_.begin()->first);
+            std::function<void()> fire = std::move(events_.begin()->second);
+            events_.erase(events_.begin());
+            fire();
+        }
+        now_ = until;
+    }
+
+    bool CancelRequested() override { return now_ >= config_.cancelAt; }
+
+    bool IsOpen(uintptr_t tab) const {
+        return std::any_of(tabs_.begin(), tabs_.end(), [tab](const ShellTab& t) { return t.id == tab; });
+    }
+    size_t FirstWindowTabCount() const {
+        return std::count_if(tabs_.begin(), tabs_.end(), [](const ShellTab& t) { return t.window == kFirstWindow; });
+    }
+
+    std::vector<double> requestTimes_;
+    std::vector<double> unlockTimes_;
+    std::map<int, uintptr_t> createdTabs_;
+    std::map<uintptr_t, std::vector<std::string>> navigations_;
+    std::vector<uintptr_t> quits_;
+    uintptr_t otherTab_ = 0;
+    size_t maxBusy_ = 0;
+    bool lockHeld_ = false;
+
+private:
+    struct PendingNavigation {
+        SimNavigation how;
+        double doneAt;
+    };
+
+    // Explorer's list is not in creation order: new tabs are inserted anywhere in the first window.
+    uintptr_t InsertTab() {
+        uintptr_t id = nextId_++;
+        tabs_.insert(tabs_.begin() + random_() % (FirstWindowTabCount() + 1), { id, kFirstWindow, "shell:start" });
+        return id;
+    }
+
+    std::string scenario_;
+    SimConfig config_;
+    std::mt19937 random_;
+    double now_ = 0.0;
+    std::multimap<double, std::function<void()>> events_;
+    std::vector<ShellTab> tabs_;
+    std::map<uintptr_t, PendingNavigation> pending_;
+    uintptr_t nextId_ = 1000;
+    size_t finished_ = 0;
+};
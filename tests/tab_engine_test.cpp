@@ -0,0 +1,280 @@
+// tab_engine_test.cpp - The tab operation engine against a simulated shell on a virtual clock (any platform)
+// Build: g++ tests/tab_engine_test.cpp -std=c++20 -I. -o tab_engine_test
+//
+// Each scenario runs a merge through TabEngine against a simulated Explorer whose clock only
+// advances while the engine waits, so timeouts of seconds run in microseconds and every run is
+// reproducible. Scenarios cover tabs that appear late and out of order, a new tab that never
+// appears (and one that appears after its request was given up), navigations that fail, hang or
+// lose their events, another process holding the new tab lock, and Ctrl+C. After every scenario
+// each navigated tab must be a tab of its own that was navigated once to its operation's folder,
+// tabs open before must be left alone, no stray tab may be left and the lock must be released.
+// A larger merge then reports the simulated throughput and the engine's own overhead per tab.
+
+#include "tab_engine.h"
+#include "sim_shell.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+class RecordingProgress : public TabProgress {
+public:
+    void Created(const TabOperation& op) override { created.insert(op.journalIndex); }
+    void Navigated(const TabOperation& op) override { navigated.insert(op.journalIndex); }
+
+    std::set<size_t> created;
+    std::set<size_t> navigated;
+};
+
+struct Scenario {
+    explicit Scenario(const std::string& n) : name(n) {}
+
+    std::string name;
+    std::vector<TabOperation> ops;
+    RecordingProgress progress;
+    size_t successCount = 0;
+};
+
+static void RunScenario(Scenario& s, SimShell& shell, size_t count, TabEngineLimits limits = TabEngineLimits()) {
+    s.ops.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        s.ops[i].url = FolderUrl(i);
+        s.ops[i].donor = kOtherWindow;
+        s.ops[i].journalIndex = i;
+    }
+    std::streambuf* out = std::cout.rdbuf(nullptr);
+    std::streambuf* err = std::cerr.rdbuf(nullptr);
+    TabEngine engine(shell, kFirstWindow, s.progress, limits);
+    s.successCount = engine.Run(s.ops);
+    std::cout.rdbuf(out);
+    std::cerr.rdbuf(err);
+}
+
+// What must hold after any merge; extraTabs counts tabs in the first window that are not ours.
+static void CheckInvariants(const Scenario& s, const SimShell& shell, size_t extraTabs) {
+    const std::string& n = s.name;
+    std::map<uintptr_t, size_t> owners;
+    size_t navigated = 0;
+    for (size_t i = 0; i < s.ops.size(); ++i) {
+        const TabOperation& op = s.ops[i];
+        std::string which = "operation " + std::to_string(i);
+        Check(op.state == TabOpState::Navigated || op.state == TabOpState::Failed || op.state == TabOpState::Canceled, n,
+              which + " finished");
+        if (op.tab) {
+            Check(++owners[op.tab] == 1, n, which + " has a tab of its own");
+            auto nav = shell.navigations_.find(op.tab);
+            Check(nav != shell.navigations_.end() && nav->second.size() == 1 && nav->second[0] == op.url, n,
+                  which + " navigated its tab once, to its own folder");
+            Check(s.progress.created.count(i) == 1, n, which + " journaled its tab");
+        }
+        if (op.state == TabOpState::Navigated) {
+            ++navigated;
+            Check(shell.IsOpen(op.tab), n, which + " left its tab open");
+            Check(s.progress.navigated.count(i) == 1, n, which + " journaled its navigation");
+        } else {
+            Check(!op.tab || !shell.IsOpen(op.tab), n, which + " closed the tab it could not navigate");
+            Check(s.progress.navigated.count(i) == 0, n, which + " did not journal a navigation");
+        }
+        if (i > 0 && op.requestedAt > 0 && s.ops[i - 1].requestedAt > 0) {
+            Check(op.requestedAt >= s.ops[i - 1].requestedAt, n, which + " requested its tab in order");
+        }
+    }
+    Check(navigated == s.successCount, n, "success count matches the navigated operations");
+    for (uintptr_t id = 1; id <= 3; ++id) {
+        Check(shell.navigations_.count(id) == 0 && shell.IsOpen(id), n, "tab open before was left alone");
+    }
+    Check(shell.FirstWindowTabCount() == 3 + navigated + extraTabs, n, "no stray tab left in the first window");
+    Check(!shell.lockHeld_, n, "new tab lock released");
+}
+
+static void LateAndReorderedTabs() {
+    Scenario s("late and reordered tabs");
+    std::mt19937 random(7);
+    std::vector<double> tabDelays, navigateDelays;
+    for (int i = 0; i < 12; ++i) {
+        tabDelays.push_back(50 + random() % 3000);
+        navigateDelays.push_back(100 + random() % 2000);
+    }
+    SimConfig config;
+    config.tabDelay = [&](int r) { return tabDelays[r]; };
+    config.navigateDelay = [&](const std::string& url) { return navigateDelays[std::stoi(url.substr(9))]; };
+    SimShell shell(s.name, config);
+    RunScenario(s, shell, 12);
+    CheckInvariants(s, shell, 0);
+    Check(s.successCount == 12, s.name, "every tab moved");
+    Check(shell.maxBusy_ <= 4, s.name, "no more than 4 tabs in flight");
+}
+
+static void LockReleasedWhileNavigating() {
+    Scenario s("lock released while navigating");
+    SimConfig config;
+    config.navigateDelay = [](const std::string&) { return 5000.0; };
+    SimShell shell(s.name, config);
+    RunScenario(s, shell, 2);
+    CheckInvariants(s, shell, 0);
+    Check(s.successCount == 2, s.name, "every tab moved");
+    Check(!shell.unlockTimes_.empty() && shell.unlockTimes_.front() < 1000, s.name,
+          "lock released once both tabs were claimed, not after the navigations");
+}
+
+static void TabTimeoutAndLateTab() {
+    Scenario s("tab timeout and late tab");
+    SimConfig config;
+    config.tabDelay = [](int r) { return r == 0 ? 9000.0 : 100.0 * r; };
+    SimShell shell(s.name, config);
+    RunScenario(s, shell, 3);
+    CheckInvariants(s, shell, 0);
+    // The tabs of requests 1 and 2 go to the two oldest operations; the last one gives up at the
+    // deadline and the tab of request 0, when it finally appears, is closed.
+    Check(s.ops[0].state == TabOpState::Navigated && s.ops[1].state == TabOpState::Navigated, s.name, "first two moved");
+    Check(s.ops[2].state == TabOpState::Failed && s.ops[2].tab == 0, s.name, "last one timed out without a tab");
+    Check(s.ops[2].completedAt - s.ops[2].requestedAt >= 8000, s.name, "timeout not before the tab deadline");
+    Check(shell.quits_.size() == 1 && shell.createdTabs_.count(0) && shell.quits_[0] == shell.createdTabs_[0], s.name,
+          "late tab closed");
+}
+
+static void TabNeverAppears() {
+    Scenario s("tab never appears");
+    SimConfig config;
+    config.tabDelay = [](int r) { return r == 1 ? kNever : 100.0; };
+    SimShell shell(s.name, config);
+    RunScenario(s, shell, 3);
+    CheckInvariants(s, shell, 0);
+    Check(s.successCount == 2 && s.ops[2].state == TabOpState::Failed, s.name, "two moved, one timed out");
+    Check(shell.quits_.empty(), s.name, "no tab closed");
+}
+
+static void NavigationFailures() {
+    Scenario s("navigation failures");
+    SimConfig config;
+    config.navigation = [](const std::string& url) {
+        return url == FolderUrl(1) ? SimNavigation::Fails : url == FolderUrl(2) ? SimNavigation::Rejected : SimNavigation::Completes;
+    };
+    SimShell shell(s.name, config);
+    RunScenario(s, shell, 3);
+    CheckInvariants(s, shell, 0);
+    Check(s.ops[0].state == TabOpState::Navigated, s.name, "working folder moved");
+    Check(s.ops[1].state == TabOpState::Failed && s.ops[2].state == TabOpState::Failed, s.name, "failed folders not moved");
+    Check(shell.quits_.size() == 2, s.name, "both failed tabs closed");
+}
+
+static void NavigationTimeouts() {
+    Scenario s("navigation timeouts");
+    SimConfig config;
+    config.navigation = [](const std::string& url) {
+        return url == FolderUrl(0) ? SimNavigation::Hangs : url == FolderUrl(1) ? SimNavigation::EventsLost : SimNavigation::Completes;
+    };
+    SimShell shell(s.name, config);
+    RunScenario(s, shell, 3);
+    CheckInvariants(s, shell, 0);
+    Check(s.ops[0].state == TabOpState::Failed && s.ops[0].completedAt - s.ops[0].navigateStartedAt >= 15000, s.name,
+          "hung navigation given up at the deadline");
+    Check(s.ops[1].state == TabOpState::Navigated && s.ops[1].completedAt - s.ops[1].navigateStartedAt >= 15000, s.name,
+          "navigation without events confirmed at the deadline");
+    Check(s.ops[2].state == TabOpState::Navigated && s.ops[2].completedAt - s.ops[2].navigateStartedAt < 1000, s.name,
+          "normal navigation confirmed right away");
+}
+
+static void LockContention() {
+    Scenario s("lock contention");
+    SimConfig config;
+    config.otherLockUntil = 2000;
+    config.otherTabAt = 1500;
+    SimShell shell(s.name, config);
+    RunScenario(s, shell, 3);
+    CheckInvariants(s, shell, 1);
+    Check(s.successCount == 3, s.name, "every tab moved");
+    Check(shell.requestTimes_.size() == 3 && shell.requestTimes_.front() >= 2000, s.name,
+          "no request sent before the other process released the lock");
+    Check(shell.otherTab_ && shell.IsOpen(shell.otherTab_) && shell.navigations_.count(shell.otherTab_) == 0, s.name,
+          "the other process's tab was not claimed");
+}
+
+static void LockWaitTimeout() {
+    Scenario s("lock wait timeout");
+    SimConfig config;
+    config.otherLockUntil = kNever;
+    SimShell shell(s.name, config);
+    RunScenario(s, shell, 3);
+    CheckInvariants(s, shell, 0);
+    Check(shell.requestTimes_.empty(), s.name, "no request sent");
+    for (const auto& op : s.ops) {
+        Check(op.state == TabOpState::Failed && op.completedAt >= 60000, s.name, "gave up after the lock wait");
+    }
+}
+
+static void CancelInFlight() {
+    Scenario s("cancel with tabs in flight");
+    SimConfig config;
+    config.cancelAt = 50;
+    SimShell shell(s.name, config);
+    RunScenario(s, shell, 10);
+    CheckInvariants(s, shell, 0);
+    Check(shell.requestTimes_.size() == 4 && s.successCount == 4, s.name, "tabs in flight finished");
+    for (size_t i = 4; i < s.ops.size(); ++i) {
+        Check(s.ops[i].state == TabOpState::Canceled, s.name, "operation " + std::to_string(i) + " canceled");
+    }
+}
+
+static void CancelWhileWaitingForLock() {
+    Scenario s("cancel while waiting for the lock");
+    SimConfig config;
+    config.otherLockUntil = 5000;
+    config.cancelAt = 1000;
+    SimShell shell(s.name, config);
+    RunScenario(s, shell, 6);
+    CheckInvariants(s, shell, 0);
+    Check(shell.requestTimes_.empty(), s.name, "no request sent");
+    for (const auto& op : s.ops) {
+        Check(op.state == TabOpState::Canceled, s.name, "operation canceled");
+    }
+}
+
+static void Throughput() {
+    const size_t count = 500;
+    Scenario s("throughput");
+    std::mt19937 random(29);
+    std::vector<double> tabDelays, navigateDelays;
+    for (size_t i = 0; i < count; ++i) {
+        tabDelays.push_back(20 + random() % 400);
+        navigateDelays.push_back(50 + random() % 800);
+    }
+    SimConfig config;
+    config.tabDelay = [&](int r) { return tabDelays[r]; };
+    config.navigateDelay = [&](const std::string& url) { return navigateDelays[std::stoul(url.substr(9))]; };
+    SimShell shell(s.name, config);
+    auto start = std::chrono::steady_clock::now();
+    RunScenario(s, shell, count);
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    CheckInvariants(s, shell, 0);
+    Check(s.successCount == count, s.name, "every tab moved");
+    Check(shell.maxBusy_ <= 4, s.name, "no more than 4 tabs in flight");
+    double simulatedMs = shell.NowMs();
+    std::cout << "tab_engine_test: " << count << " tabs in " << (long)simulatedMs << " simulated ms ("
+              << (long)(count * 1000.0 / simulatedMs) << " tabs/s), engine overhead "
+              << (long)(wallMs * 1000.0 / count) << " us per tab\n";
+}
+
+int main() {
+    LateAndReorderedTabs();
+    LockReleasedWhileNavigating();
+    TabTimeoutAndLateTab();
+    TabNeverAppears();
+    NavigationFailures();
+    NavigationTimeouts();
+    LockContention();
+    LockWaitTimeout();
+    CancelInFlight();
+    CancelWhileWaitingForLock();
+    Throughput();
+
+    if (g_failures) {
+        std::cerr << "tab_engine_test: " << g_failures << " failure(s)\n";
+        return 1;
+    }
+    std::cout << "tab_engine_test: all scenarios passed\n";
+    return 0;
+}